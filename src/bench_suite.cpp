@@ -0,0 +1,775 @@
+// Benchmark suite: fixed, seeded scenes that each stress one part of the
+// pipeline, timed after a warmup over several repeats. Prints JSON so runs
+// can be compared across commits and machines.
+//
+// usage: rasterbench_suite [--width w] [--height h] [--threads n]
+//                          [--frames n] [--repeats n] [--warmup n]
+//                          [--scene name] [--json path] [--tiled] [--msaa]
+//                          [--verify]
+//
+// --verify checks the SIMD matrix kernels against their scalar reference
+// instead of running the scenes.
+
+#include "bounds.hpp"
+#include "framebuffer.hpp"
+#include "matrix.hpp"
+#include "renderer.hpp"
+#include "scene_bvh.hpp"
+#include "texture.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+struct suite_options {
+  u32 width = 800;
+  u32 height = 600;
+  u32 threads = std::thread::hardware_concurrency();
+  u32 frames = 20;
+  u32 repeats = 5;
+  u32 warmup = 5;
+  const char *scene = nullptr; // run only this scene
+  const char *json_path = nullptr;
+  b8 tiled = false;
+  b8 msaa = false;
+  b8 verify = false;
+};
+
+template <u32 Floats> struct bench_vertex {
+  math::vec4 pos; // clip space
+  f32 vars[Floats];
+};
+
+// Passes the varyings through and runs Work dependent sin() steps per
+// fragment. Count builds a variant that counts the fragments it shades.
+template <u32 Floats, u32 Work, b8 Count> struct bench_shader {
+  u64 *fragments = nullptr;
+
+  size varying_size() const { return Floats * sizeof(f32); }
+
+  void vertex_shader(const void *in, math::vec4 *out_pos,
+                     void *out_var) const {
+    const bench_vertex<Floats> *v = (const bench_vertex<Floats> *)in;
+    *out_pos = v->pos;
+    std::memcpy(out_var, v->vars, sizeof(v->vars));
+  }
+
+  math::vec4 fragment_shader(void *in_var) const {
+    if constexpr (Count)
+      ++*fragments;
+
+    const f32 *vars = (const f32 *)in_var;
+
+    // every varying contributes, so none of them is optimized away
+    f32 extra = 0.f;
+    for (u32 i = 4; i < Floats; ++i)
+      extra += vars[i];
+
+    f32 v = vars[0];
+    for (u32 i = 0; i < Work; ++i)
+      v = std::sin(v * 1.3f + 0.7f);
+
+    return math::vec4{vars[0] + extra * 1e-3f, vars[1], vars[2] + v * 1e-3f,
+                      vars[3]};
+  }
+};
+
+// Samples texture slot 0 at varyings 0 and 1 through the quad entry point,
+// so the lod follows the derivatives.
+template <b8 Count> struct bench_texture_shader {
+  u64 *fragments = nullptr;
+
+  size varying_size() const { return 4 * sizeof(f32); }
+
+  void vertex_shader(const void *in, math::vec4 *out_pos,
+                     void *out_var) const {
+    const bench_vertex<4> *v = (const bench_vertex<4> *)in;
+    *out_pos = v->pos;
+    std::memcpy(out_var, v->vars, sizeof(v->vars));
+  }
+
+  void fragment_shader_quad(const fragment_quad &quad,
+                            math::vec4 out_colors[quad_lanes]) const {
+    if constexpr (Count)
+      *fragments += (u64)std::popcount(quad.mask);
+
+    quad.textures[0].sample_quad(quad, 0, 1, out_colors);
+  }
+};
+
+struct world_vertex {
+  math::vec3 pos;
+  f32 vars[4];
+};
+
+// Transforms world space positions by a camera, the varyings pass through.
+template <b8 Count> struct bench_camera_shader {
+  const math::mat4 *view_proj;
+  u64 *fragments = nullptr;
+
+  size varying_size() const { return 4 * sizeof(f32); }
+
+  void vertex_shader(const void *in, math::vec4 *out_pos,
+                     void *out_var) const {
+    const world_vertex *v = (const world_vertex *)in;
+    *out_pos = *view_proj * math::vec4{v->pos, 1.f};
+    std::memcpy(out_var, v->vars, sizeof(v->vars));
+  }
+
+  math::vec4 fragment_shader(void *in_var) const {
+    if constexpr (Count)
+      ++*fragments;
+
+    const f32 *vars = (const f32 *)in_var;
+    return math::vec4{vars[0], vars[1], vars[2], vars[3]};
+  }
+};
+
+// Reads clip positions transformed ahead of the draw by transform_points,
+// the vertex buffer holds the index of each vertex into them.
+template <b8 Count> struct bench_soa_shader {
+  const math::soa_points_out *clip;
+  const f32 (*vars)[4];
+  u64 *fragments = nullptr;
+
+  size varying_size() const { return 4 * sizeof(f32); }
+
+  void vertex_shader(const void *in, math::vec4 *out_pos,
+                     void *out_var) const {
+    u32 id = *(const u32 *)in;
+    *out_pos = math::vec4{clip->x[id], clip->y[id], clip->z[id], clip->w[id]};
+    std::memcpy(out_var, vars[id], sizeof(vars[id]));
+  }
+
+  math::vec4 fragment_shader(void *in_var) const {
+    if constexpr (Count)
+      ++*fragments;
+
+    const f32 *vars = (const f32 *)in_var;
+    return math::vec4{vars[0], vars[1], vars[2], vars[3]};
+  }
+};
+
+struct bench_scene {
+  const char *name;
+  pipeline_state state;
+
+  // Draws one frame. With fragments set, pipeline is single threaded and the
+  // shaded fragments are counted into it.
+  std::function<void(rendering_pipeline &pipeline, u64 *fragments)> draw;
+};
+
+// Small deterministic generator, the scenes must not depend on the platform's
+// std distributions.
+struct bench_rng {
+  u32 state;
+
+  f32 next() {
+    state = state * 1664525u + 1013904223u;
+    return (f32)(state >> 8) / (f32)(1u << 24);
+  }
+  f32 range(f32 lo, f32 hi) { return lo + (hi - lo) * next(); }
+};
+
+template <u32 Floats>
+static bench_vertex<Floats> make_vertex(bench_rng &rng, f32 x, f32 y, f32 z) {
+  bench_vertex<Floats> v;
+  v.pos = math::vec4{x, y, z, 1.f};
+  for (u32 i = 0; i < Floats; ++i)
+    v.vars[i] = rng.next();
+  v.vars[3] = 1.f;
+  return v;
+}
+
+// random triangles of about size (in NDC) spread over the screen
+template <u32 Floats>
+static std::vector<bench_vertex<Floats>>
+random_triangles(u32 count, f32 size, u32 seed) {
+  bench_rng rng = {seed};
+  std::vector<bench_vertex<Floats>> mesh;
+  mesh.reserve(count * 3);
+
+  for (u32 t = 0; t < count; ++t) {
+    f32 cx = rng.range(-1.f, 1.f);
+    f32 cy = rng.range(-1.f, 1.f);
+    f32 z = rng.range(-0.9f, 0.9f);
+    for (u32 v = 0; v < 3; ++v) {
+      mesh.push_back(make_vertex<Floats>(rng, cx + rng.range(-size, size),
+                                         cy + rng.range(-size, size), z));
+    }
+  }
+  return mesh;
+}
+
+// one triangle per layer that covers the whole screen, at depths from z0
+// to z1
+template <u32 Floats>
+static std::vector<bench_vertex<Floats>> fullscreen_layers(u32 layers, f32 z0,
+                                                           f32 z1) {
+  bench_rng rng = {7};
+  std::vector<bench_vertex<Floats>> mesh;
+
+  for (u32 l = 0; l < layers; ++l) {
+    f32 z = z0 + (z1 - z0) * l / std::max(layers - 1, 1u);
+    mesh.push_back(make_vertex<Floats>(rng, -1.5f, -1.5f, z));
+    mesh.push_back(make_vertex<Floats>(rng, 4.5f, -1.5f, z));
+    mesh.push_back(make_vertex<Floats>(rng, -1.5f, 4.5f, z));
+  }
+  return mesh;
+}
+
+template <u32 Floats, u32 Work>
+static bench_scene make_scene(const char *name, pipeline_state state,
+                              std::vector<bench_vertex<Floats>> mesh) {
+
+  auto draw = [mesh = std::move(mesh)](rendering_pipeline &pipeline,
+                                       u64 *fragments) {
+    vertex_buffer vbuf(mesh.data(), sizeof(bench_vertex<Floats>));
+    if (fragments) {
+      pipeline.draw(bench_shader<Floats, Work, true>{fragments}, vbuf,
+                    (i32)mesh.size());
+    } else {
+      pipeline.draw(bench_shader<Floats, Work, false>{}, vbuf,
+                    (i32)mesh.size());
+    }
+  };
+
+  return bench_scene{name, state, draw};
+}
+
+// size x size checkerboard of 8 texel squares, with a gradient so the mips
+// don't all average to the same gray
+static std::shared_ptr<texture> checker_texture(u32 size) {
+  std::vector<color> texels((size_t)size * size);
+  for (u32 y = 0; y < size; ++y) {
+    for (u32 x = 0; x < size; ++x) {
+      u8 on = ((x >> 3) ^ (y >> 3)) & 1 ? 255 : 0;
+      texels[(size_t)y * size + x] =
+          color{on, (u8)(x * 255 / size), (u8)(y * 255 / size), 255};
+    }
+  }
+  return std::make_shared<texture>(texels.data(), size, size);
+}
+
+// random triangles whose texture coordinates span scale repeats of the
+// texture, so a large scale minifies it
+static bench_scene make_textured_scene(const char *name, pipeline_state state,
+                                       u32 count, f32 size, f32 scale,
+                                       sampler_state sampler) {
+  std::vector<bench_vertex<4>> mesh = random_triangles<4>(count, size, 5);
+  for (bench_vertex<4> &v : mesh) {
+    v.vars[0] *= scale;
+    v.vars[1] *= scale;
+  }
+
+  std::shared_ptr<texture> tex = checker_texture(1024);
+
+  auto draw = [mesh = std::move(mesh), tex, sampler](
+                  rendering_pipeline &pipeline, u64 *fragments) {
+    pipeline.bind_texture(0, tex.get(), sampler);
+
+    vertex_buffer vbuf(mesh.data(), sizeof(bench_vertex<4>));
+    if (fragments) {
+      pipeline.draw(bench_texture_shader<true>{fragments}, vbuf,
+                    (i32)mesh.size());
+    } else {
+      pipeline.draw(bench_texture_shader<false>{}, vbuf, (i32)mesh.size());
+    }
+  };
+
+  return bench_scene{name, state, draw};
+}
+
+// A grid of side x side x side unit cubes, one draw each, seen by a camera
+// inside the grid that only has a fraction of them in view. The cubes are
+// culled through a scene_bvh before any vertex is shaded.
+static bench_scene make_objects_scene(const char *name, pipeline_state state,
+                                      u32 side, f32 spacing) {
+  static constexpr u32 cube_vertices = 36;
+  static constexpr i32 faces[6][4][3] = {
+      {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0}},
+      {{0, 0, 1}, {0, 1, 1}, {1, 1, 1}, {1, 0, 1}},
+      {{0, 0, 0}, {0, 1, 0}, {0, 1, 1}, {0, 0, 1}},
+      {{1, 0, 0}, {1, 0, 1}, {1, 1, 1}, {1, 1, 0}},
+      {{0, 0, 0}, {0, 0, 1}, {1, 0, 1}, {1, 0, 0}},
+      {{0, 1, 0}, {1, 1, 0}, {1, 1, 1}, {0, 1, 1}}};
+
+  bench_rng rng = {6};
+  std::vector<world_vertex> mesh;
+  std::vector<aabb> boxes;
+  for (u32 z = 0; z < side; ++z) {
+    for (u32 y = 0; y < side; ++y) {
+      for (u32 x = 0; x < side; ++x) {
+        math::vec3 origin = math::vec3{(f32)x, (f32)y, (f32)z} * spacing;
+        size first = mesh.size();
+
+        for (const auto &face : faces) {
+          for (i32 corner : {0, 1, 2, 0, 2, 3}) {
+            world_vertex v;
+            v.pos = origin + math::vec3{(f32)face[corner][0],
+                                        (f32)face[corner][1],
+                                        (f32)face[corner][2]};
+            for (f32 &var : v.vars)
+              var = rng.next();
+            v.vars[3] = 1.f;
+            mesh.push_back(v);
+          }
+        }
+
+        boxes.push_back(compute_mesh_bounds(mesh.data() + first,
+                                            sizeof(world_vertex),
+                                            cube_vertices)
+                            .box);
+      }
+    }
+  }
+
+  auto bvh = std::make_shared<scene_bvh>();
+  bvh->build(boxes.data(), (u32)boxes.size());
+
+  f32 extent = side * spacing;
+  math::mat4 view_proj =
+      math::mat4::perspective(0.5f, 2.f * extent, 1.f, 1.f) *
+      math::mat4::look_at(math::vec3{0.5f, 0.5f, 0.5f} * extent,
+                          math::vec3{extent, 0.6f * extent, 0.7f * extent},
+                          math::vec3{0.f, 1.f, 0.f});
+
+  auto draw = [mesh = std::move(mesh), bvh, view_proj,
+               visible = std::vector<u32>()](rendering_pipeline &pipeline,
+                                             u64 *fragments) mutable {
+    pipeline.set_view_projection(view_proj);
+    pipeline.cull_draws(*bvh, visible);
+
+    for (u32 object : visible) {
+      vertex_buffer vbuf(mesh.data() + object * cube_vertices,
+                         sizeof(world_vertex));
+      if (fragments) {
+        pipeline.draw(bench_camera_shader<true>{&view_proj, fragments}, vbuf,
+                      cube_vertices);
+      } else {
+        pipeline.draw(bench_camera_shader<false>{&view_proj}, vbuf,
+                      cube_vertices);
+      }
+    }
+  };
+
+  return bench_scene{name, state, draw};
+}
+
+// The positions of count small triangles are transformed as one batch per
+// frame with transform_points before the draw, the way a CPU skinning or
+// animation pass would, so the batch transform is timed with the draw.
+static bench_scene make_batched_scene(const char *name, pipeline_state state,
+                                      u32 count, f32 size) {
+  struct soa_mesh {
+    std::vector<f32> x, y, z; // model space
+    std::vector<f32> cx, cy, cz, cw; // clip space, written every frame
+    std::vector<std::array<f32, 4>> vars;
+    std::vector<u32> ids;
+    math::soa_points_out clip;
+  };
+
+  auto mesh = std::make_shared<soa_mesh>();
+  for (const bench_vertex<4> &v : random_triangles<4>(count, size, 7)) {
+    mesh->x.push_back(v.pos.x);
+    mesh->y.push_back(v.pos.y);
+    mesh->z.push_back(v.pos.z);
+    mesh->vars.push_back({v.vars[0], v.vars[1], v.vars[2], v.vars[3]});
+    mesh->ids.push_back((u32)mesh->ids.size());
+  }
+
+  u32 n = (u32)mesh->ids.size();
+  mesh->cx.resize(n);
+  mesh->cy.resize(n);
+  mesh->cz.resize(n);
+  mesh->cw.resize(n);
+  mesh->clip = math::soa_points_out{mesh->cx.data(), mesh->cy.data(),
+                                    mesh->cz.data(), mesh->cw.data()};
+
+  math::mat4 transform =
+      math::mat4::rotation_z(0.3f) * math::mat4::scale(0.9f);
+
+  auto draw = [mesh, transform](rendering_pipeline &pipeline,
+                                u64 *fragments) {
+    u32 n = (u32)mesh->ids.size();
+    math::transform_points(transform,
+                           math::soa_points_in{mesh->x.data(), mesh->y.data(),
+                                               mesh->z.data(), nullptr},
+                           mesh->clip, n);
+
+    vertex_buffer vbuf(mesh->ids.data(), sizeof(u32));
+    const f32(*vars)[4] = (const f32(*)[4])mesh->vars.data();
+    if (fragments) {
+      pipeline.draw(bench_soa_shader<true>{&mesh->clip, vars, fragments},
+                    vbuf, (i32)n);
+    } else {
+      pipeline.draw(bench_soa_shader<false>{&mesh->clip, vars}, vbuf,
+                    (i32)n);
+    }
+  };
+
+  return bench_scene{name, state, draw};
+}
+
+static std::vector<bench_scene> build_scenes() {
+  pipeline_state no_depth;
+
+  pipeline_state depth_less;
+  depth_less.depth.test_enable = true;
+  depth_less.depth.write_enable = true;
+
+  std::vector<bench_scene> scenes;
+
+  // triangle setup and binning bound, a few pixels each
+  scenes.push_back(make_scene<4, 0>("tiny_triangles", no_depth,
+                                    random_triangles<4>(100000, 0.006f, 1)));
+
+  // fill bound, every triangle spans most of the screen
+  scenes.push_back(make_scene<4, 0>("huge_triangles", no_depth,
+                                    random_triangles<4>(16, 2.f, 2)));
+
+  // the same fill through the output merger, which reads every pixel back
+  pipeline_state alpha_blend = no_depth;
+  alpha_blend.blend = blend_mode::alpha;
+  scenes.push_back(make_scene<4, 0>("huge_triangles_alpha_blend", alpha_blend,
+                                    random_triangles<4>(16, 2.f, 2)));
+
+  // every layer passes the depth test and gets shaded
+  scenes.push_back(make_scene<4, 0>("overdraw_back_to_front", depth_less,
+                                    fullscreen_layers<4>(32, 0.9f, -0.9f)));
+
+  // only the first layer gets shaded, the rest is early z / hi-z rejected
+  scenes.push_back(make_scene<4, 0>("overdraw_front_to_back", depth_less,
+                                    fullscreen_layers<4>(32, -0.9f, 0.9f)));
+
+  // interpolation bound
+  scenes.push_back(make_scene<32, 0>("many_varyings", no_depth,
+                                     random_triangles<32>(2000, 0.08f, 3)));
+
+  // shader bound
+  scenes.push_back(make_scene<4, 64>("expensive_fragment_shader", no_depth,
+                                     random_triangles<4>(200, 0.25f, 4)));
+
+  // texture bound, 1024^2 texels squeezed onto small triangles: the mips
+  // keep the footprint in cache, mip_filter::none reads all of level 0
+  sampler_state trilinear;
+  trilinear.mip = mip_filter::linear;
+  scenes.push_back(make_textured_scene("textured_minified", no_depth, 2000,
+                                       0.1f, 8.f, trilinear));
+
+  sampler_state no_mips;
+  no_mips.mip = mip_filter::none;
+  scenes.push_back(make_textured_scene("textured_minified_no_mips", no_depth,
+                                       2000, 0.1f, 8.f, no_mips));
+
+  // vertex bound, positions transformed in one SoA batch per frame
+  scenes.push_back(make_batched_scene("batched_transform", no_depth, 100000,
+                                      0.006f));
+
+  // draw call bound, 32^3 small objects of which most are out of view
+  scenes.push_back(make_objects_scene("culled_objects", depth_less, 32, 2.f));
+
+  return scenes;
+}
+
+struct scene_result {
+  const bench_scene *scene;
+  u64 fragments; // per frame
+  u64 submitted; // triangles handed to draws per frame, after draw culling
+  u64 rasterized; // of those that reached the raster stage
+  std::vector<f64> repeat_ms; // mean draw time per frame of each repeat
+};
+
+static f64 time_frames(rendering_pipeline &pipeline, framebuffer &fb,
+                       const bench_scene &scene, u32 frames) {
+  f64 total = 0.0;
+
+  for (u32 frame = 0; frame < frames; ++frame) {
+    fb.clear_color(colors::black);
+    fb.clear_depth(1.f);
+
+    // only the draw is timed, clears are not part of the scene
+    auto start = std::chrono::steady_clock::now();
+    scene.draw(pipeline, nullptr);
+    auto end = std::chrono::steady_clock::now();
+
+    total += std::chrono::duration<f64, std::milli>(end - start).count();
+  }
+
+  return total / frames;
+}
+
+static scene_result run_scene(const bench_scene &scene,
+                              const suite_options &opts) {
+  scene_result result = {&scene, 0, 0, 0, {}};
+  framebuffer fb(opts.width, opts.height,
+                 opts.tiled ? framebuffer_layout::tiled
+                            : framebuffer_layout::linear,
+                 opts.msaa ? msaa_samples : 1);
+
+  {
+    rendering_pipeline counter(fb, 1);
+    counter.set_pipeline_state(scene.state);
+    fb.clear_color(colors::black);
+    fb.clear_depth(1.f);
+    scene.draw(counter, &result.fragments);
+
+    pipeline_stats stats = counter.get_pipeline_stats();
+    result.submitted = stats.primitives_submitted;
+    result.rasterized = stats.primitives_rasterized;
+  }
+
+  rendering_pipeline pipeline(fb, opts.threads);
+  pipeline.set_pipeline_state(scene.state);
+
+  time_frames(pipeline, fb, scene, opts.warmup);
+
+  for (u32 r = 0; r < opts.repeats; ++r)
+    result.repeat_ms.push_back(time_frames(pipeline, fb, scene, opts.frames));
+
+  return result;
+}
+
+static void write_json(FILE *out, const suite_options &opts,
+                       const std::vector<scene_result> &results) {
+#if defined(__AVX2__)
+  const char *isa = "avx2";
+#elif defined(__SSE2__)
+  const char *isa = "sse2";
+#else
+  const char *isa = "scalar";
+#endif
+
+  std::fprintf(out, "{\n");
+  std::fprintf(out, "  \"width\": %u,\n  \"height\": %u,\n", opts.width,
+               opts.height);
+  std::fprintf(out, "  \"threads\": %u,\n  \"isa\": \"%s\",\n", opts.threads,
+               isa);
+  std::fprintf(out, "  \"layout\": \"%s\",\n  \"samples\": %u,\n",
+               opts.tiled ? "tiled" : "linear", opts.msaa ? msaa_samples : 1);
+  std::fprintf(out, "  \"frames\": %u,\n  \"repeats\": %u,\n", opts.frames,
+               opts.repeats);
+  std::fprintf(out, "  \"warmup\": %u,\n  \"scenes\": [", opts.warmup);
+
+  for (size i = 0; i < results.size(); ++i) {
+    const scene_result &r = results[i];
+
+    std::vector<f64> sorted = r.repeat_ms;
+    std::sort(sorted.begin(), sorted.end());
+    f64 median = sorted[sorted.size() / 2];
+    f64 seconds = median / 1000.0;
+
+    std::fprintf(out, "%s\n    {\n", i ? "," : "");
+    std::fprintf(out, "      \"name\": \"%s\",\n", r.scene->name);
+    std::fprintf(out, "      \"triangles_submitted\": %llu,\n",
+                 (unsigned long long)r.submitted);
+    std::fprintf(out, "      \"triangles_rasterized\": %llu,\n",
+                 (unsigned long long)r.rasterized);
+    std::fprintf(out, "      \"fragments_per_frame\": %llu,\n",
+                 (unsigned long long)r.fragments);
+    std::fprintf(out, "      \"ms_per_frame_median\": %.4f,\n", median);
+    std::fprintf(out, "      \"ms_per_frame_min\": %.4f,\n", sorted.front());
+    std::fprintf(out, "      \"ms_per_frame_max\": %.4f,\n", sorted.back());
+    std::fprintf(out, "      \"mtri_per_s\": %.3f,\n",
+                 r.submitted / seconds / 1e6);
+    std::fprintf(out, "      \"mpix_per_s\": %.3f,\n",
+                 r.fragments / seconds / 1e6);
+    std::fprintf(out, "      \"ns_per_fragment\": %.3f\n",
+                 r.fragments ? median * 1e6 / r.fragments : 0.0);
+    std::fprintf(out, "    }");
+  }
+
+  std::fprintf(out, "\n  ]\n}\n");
+}
+
+// Largest difference between a and b relative to the magnitude of a.
+static f32 relative_error(const f32 *a, const f32 *b, u32 count) {
+  f32 scale = 1.f, error = 0.f;
+  for (u32 i = 0; i < count; ++i) {
+    scale = std::max(scale, std::fabs(a[i]));
+    error = std::max(error, std::fabs(a[i] - b[i]));
+  }
+  return error / scale;
+}
+
+/// <summary>
+/// Compares the SIMD matrix kernels of matrix.hpp with math::reference on
+/// random, well conditioned matrices and reports every mismatch.
+/// </summary>
+/// <returns>true if all of them agree</returns>
+static b8 verify_math_kernels() {
+  constexpr f32 tolerance = 1e-5f;
+  constexpr f32 inverse_tolerance = 1e-4f;
+
+  bench_rng rng = {11};
+  auto random_matrix = [&] {
+    // diagonally dominant, so the inverse is well conditioned
+    math::mat4 m;
+    for (i32 i = 0; i < 16; ++i)
+      m.values[i] = rng.range(-1.f, 1.f) + (i % 5 == 0 ? 4.f : 0.f);
+    return m;
+  };
+
+  u32 failures = 0;
+  auto check = [&](const char *kernel, f32 error, f32 limit) {
+    if (error > limit) {
+      std::fprintf(stderr, "verify: %s differs by %g\n", kernel, error);
+      ++failures;
+    }
+  };
+
+  for (u32 round = 0; round < 1000; ++round) {
+    math::mat4 a = random_matrix();
+    math::mat4 b = random_matrix();
+    math::vec4 v = {rng.range(-10.f, 10.f), rng.range(-10.f, 10.f),
+                    rng.range(-10.f, 10.f), rng.range(-10.f, 10.f)};
+
+    math::mat4 ab = a * b;
+    math::mat4 ref_ab = math::reference::mul(a, b);
+    check("mat4 * mat4", relative_error(ref_ab.values, ab.values, 16),
+          tolerance);
+
+    math::vec4 av = a * v;
+    math::vec4 ref_av = math::reference::mul(a, v);
+    check("mat4 * vec4", relative_error(ref_av.values, av.values, 4),
+          tolerance);
+
+    math::mat4 t = math::transpose(a);
+    math::mat4 ref_t = math::reference::transpose(a);
+    check("transpose", relative_error(ref_t.values, t.values, 16), 0.f);
+
+    math::mat4 inv = math::inverse(a);
+    math::mat4 ref_inv = math::reference::inverse(a);
+    check("inverse", relative_error(ref_inv.values, inv.values, 16),
+          inverse_tolerance);
+  }
+
+  // every path of transform_points: 8 and 4 wide and the scalar tail, with
+  // and without w
+  constexpr u32 count = 8 + 4 + 3;
+  f32 in[4][count], out[4][count], ref[4][count];
+  for (u32 c = 0; c < 4; ++c) {
+    for (u32 i = 0; i < count; ++i)
+      in[c][i] = rng.range(-10.f, 10.f);
+  }
+
+  math::mat4 m = random_matrix();
+  for (b8 with_w : {false, true}) {
+    math::soa_points_in points = {in[0], in[1], in[2],
+                                  with_w ? in[3] : nullptr};
+    math::transform_points(m, points, {out[0], out[1], out[2], out[3]},
+                           count);
+    math::reference::transform_points(m, points,
+                                      {ref[0], ref[1], ref[2], ref[3]}, count);
+    for (u32 c = 0; c < 4; ++c) {
+      check("transform_points", relative_error(ref[c], out[c], count),
+            tolerance);
+    }
+  }
+
+  std::fprintf(stderr, "verify: %s\n", failures ? "FAILED" : "ok");
+  return failures == 0;
+}
+
+static b8 parse_options(int argc, char *argv[], suite_options &opts) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (!std::strcmp(arg, "--tiled")) {
+      opts.tiled = true;
+      continue;
+    }
+    if (!std::strcmp(arg, "--msaa")) {
+      opts.msaa = true;
+      continue;
+    }
+    if (!std::strcmp(arg, "--verify")) {
+      opts.verify = true;
+      continue;
+    }
+
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      std::fprintf(stderr, "missing value for %s\n", arg);
+      return false;
+    }
+    ++i;
+
+    u32 number = (u32)std::strtoul(value, nullptr, 10);
+    if (!std::strcmp(arg, "--width"))
+      opts.width = number;
+    else if (!std::strcmp(arg, "--height"))
+      opts.height = number;
+    else if (!std::strcmp(arg, "--threads"))
+      opts.threads = number;
+    else if (!std::strcmp(arg, "--frames"))
+      opts.frames = number;
+    else if (!std::strcmp(arg, "--repeats"))
+      opts.repeats = number;
+    else if (!std::strcmp(arg, "--warmup"))
+      opts.warmup = number;
+    else if (!std::strcmp(arg, "--scene"))
+      opts.scene = value;
+    else if (!std::strcmp(arg, "--json"))
+      opts.json_path = value;
+    else {
+      std::fprintf(stderr, "unknown option %s\n", arg);
+      return false;
+    }
+  }
+
+  return opts.width > 0 && opts.height > 0 && opts.frames > 0 &&
+         opts.repeats > 0;
+}
+
+int main(int argc, char *argv[]) {
+  suite_options opts;
+  if (!parse_options(argc, argv, opts)) {
+    std::fprintf(stderr,
+                 "usage: rasterbench_suite [--width w] [--height h] "
+                 "[--threads n] [--frames n] [--repeats n] [--warmup n] "
+                 "[--scene name] [--json path] [--tiled] [--msaa] "
+                 "[--verify]\n");
+    return 1;
+  }
+
+  if (opts.verify)
+    return verify_math_kernels() ? 0 : 1;
+
+  std::vector<bench_scene> scenes = build_scenes();
+  std::vector<scene_result> results;
+
+  for (const bench_scene &scene : scenes) {
+    if (opts.scene && std::strcmp(opts.scene, scene.name))
+      continue;
+
+    std::fprintf(stderr, "running %s\n", scene.name);
+    results.push_back(run_scene(scene, opts));
+  }
+
+  if (results.empty()) {
+    std::fprintf(stderr, "no scene named %s\n", opts.scene);
+    return 1;
+  }
+
+  FILE *out = stdout;
+  if (opts.json_path) {
+    out = std::fopen(opts.json_path, "w");
+    if (!out) {
+      std::fprintf(stderr, "failed to open %s\n", opts.json_path);
+      return 1;
+    }
+  }
+
+  write_json(out, opts, results);
+
+  if (out != stdout)
+    std::fclose(out);
+  return 0;
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "matrix.hpp"
+#include "types.hpp"
+#include "vector.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+struct aabb {
+  math::vec3 min, max;
+
+  static aabb empty() {
+    constexpr f32 inf = std::numeric_limits<f32>::infinity();
+    return aabb{math::vec3{inf, inf, inf}, math::vec3{-inf, -inf, -inf}};
+  }
+
+  inline void grow(const math::vec3 &p) {
+    min = math::vec3{std::min(min.x, p.x), std::min(min.y, p.y),
+                     std::min(min.z, p.z)};
+    max = math::vec3{std::max(max.x, p.x), std::max(max.y, p.y),
+                     std::max(max.z, p.z)};
+  }
+
+  inline void grow(const aabb &b) {
+    grow(b.min);
+    grow(b.max);
+  }
+
+  inline math::vec3 center() const { return (min + max) * 0.5f; }
+  inline math::vec3 extent() const { return (max - min) * 0.5f; }
+};
+
+struct bounding_sphere {
+  math::vec3 center;
+  f32 radius;
+};
+
+// Bounds of a mesh in its own (model) space, see compute_mesh_bounds.
+struct mesh_bounds {
+  aabb box;
+  bounding_sphere sphere;
+};
+
+/// <summary>
+/// Bounds of count vertices whose position is a vec3 at offset bytes into
+/// each stride bytes long vertex. The sphere is centered on the box, which
+/// is not the tightest sphere but never misses a vertex.
+/// </summary>
+static inline mesh_bounds compute_mesh_bounds(const void *vertices,
+                                              size stride, size count,
+                                              size offset = 0) {
+  const u8 *base = (const u8 *)vertices + offset;
+
+  mesh_bounds out = {aabb::empty(), {}};
+  for (size i = 0; i < count; ++i)
+    out.box.grow(*(const math::vec3 *)(base + i * stride));
+
+  out.sphere.center = out.box.center();
+  f32 r2 = 0.f;
+  for (size i = 0; i < count; ++i) {
+    math::vec3 d = *(const math::vec3 *)(base + i * stride) - out.sphere.center;
+    r2 = std::max(r2, dot(d, d));
+  }
+  out.sphere.radius = std::sqrt(r2);
+  return out;
+}
+
+// Box around b after the affine transform m (Arvo's method).
+static inline aabb transform(const aabb &b, const math::mat4 &m) {
+  math::vec3 c = b.center();
+  math::vec3 e = b.extent();
+
+  math::vec3 center, extent;
+  for (i32 row = 0; row < 3; ++row) {
+    const f32 *v = m.values;
+    center.values[row] = v[row] * c.x + v[4 + row] * c.y + v[8 + row] * c.z +
+                         v[12 + row];
+    extent.values[row] = std::abs(v[row]) * e.x +
+                         std::abs(v[4 + row]) * e.y +
+                         std::abs(v[8 + row]) * e.z;
+  }
+  return aabb{center - extent, center + extent};
+}
+
+// s after the affine transform m, the radius grows with the largest scale.
+static inline bounding_sphere transform(const bounding_sphere &s,
+                                        const math::mat4 &m) {
+  const f32 *v = m.values;
+  f32 scale2 = 0.f;
+  for (i32 col = 0; col < 3; ++col) {
+    const f32 *c = v + col * 4;
+    scale2 = std::max(scale2, c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+  }
+
+  math::vec4 center = m * math::vec4{s.center, 1.f};
+  return bounding_sphere{math::vec3{center.x, center.y, center.z},
+                         s.radius * std::sqrt(scale2)};
+}
+
+enum class frustum_test : u8 { outside, intersects, inside };
+
+// The six clip planes of a view projection matrix, normals pointing inwards
+// (Gribb and Hartmann). A point p is inside plane i when
+// dot(planes[i], (p, 1)) >= 0.
+struct frustum {
+  math::vec4 planes[6];
+
+  static frustum from_matrix(const math::mat4 &m) {
+    // rows of the column major matrix
+    math::vec4 row[4];
+    for (i32 r = 0; r < 4; ++r) {
+      row[r] = math::vec4{m.values[r], m.values[4 + r], m.values[8 + r],
+                          m.values[12 + r]};
+    }
+
+    // -w <= x, y, z <= w
+    frustum f;
+    for (i32 axis = 0; axis < 3; ++axis) {
+      f.planes[axis * 2] = row[3] + row[axis];
+      f.planes[axis * 2 + 1] = row[3] - row[axis];
+    }
+    return f;
+  }
+
+  frustum_test test(const bounding_sphere &s) const {
+    frustum_test result = frustum_test::inside;
+    for (const math::vec4 &p : planes) {
+      f32 len = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+      f32 d = p.x * s.center.x + p.y * s.center.y + p.z * s.center.z + p.w;
+      if (d < -s.radius * len)
+        return frustum_test::outside;
+      if (d < s.radius * len)
+        result = frustum_test::intersects;
+    }
+    return result;
+  }
+
+  // Conservative: boxes near a frustum corner can pass while being outside.
+  frustum_test test(const aabb &b) const {
+    math::vec3 c = b.center();
+    math::vec3 e = b.extent();
+
+    frustum_test result = frustum_test::inside;
+    for (const math::vec4 &p : planes) {
+      f32 d = p.x * c.x + p.y * c.y + p.z * c.z + p.w;
+      f32 r = std::abs(p.x) * e.x + std::abs(p.y) * e.y + std::abs(p.z) * e.z;
+      if (d < -r)
+        return frustum_test::outside;
+      if (d < r)
+        result = frustum_test::intersects;
+    }
+    return result;
+  }
+};
@@ -21,4 +21,19 @@ struct vertex_buffer {
 
   u8 *data;
   size stride;
-};
\ No newline at end of file
+};
+
+enum class index_format : u8 { u16, u32 };
+
+struct index_buffer {
+  index_buffer(const u16 *data) : data(data), format(index_format::u16) {}
+  index_buffer(const u32 *data) : data(data), format(index_format::u32) {}
+
+  inline u32 get(size i) const {
+    return format == index_format::u16 ? ((const u16 *)data)[i]
+                                       : ((const u32 *)data)[i];
+  }
+
+  const void *data;
+  index_format format;
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "shader_program.hpp"
+#include "types.hpp"
+#include "vector.hpp"
+#include <utility>
+
+// Planes in homogeneous clip space, as outcode bits.
+enum clip_plane : u32 {
+  clip_near = 1 << 0,   // z >= -w
+  clip_far = 1 << 1,    // z <= w
+  clip_left = 1 << 2,   // x >= -gx * w
+  clip_right = 1 << 3,  // x <= gx * w
+  clip_bottom = 1 << 4, // y >= -gy * w
+  clip_top = 1 << 5,    // y <= gy * w
+};
+
+static constexpr u32 num_clip_planes = 6;
+
+// Every plane can add at most one vertex to a convex polygon.
+static constexpr u32 max_clip_vertices = 3 + num_clip_planes;
+
+struct clip_vertex {
+  math::vec4 pos;
+  f32 vars[max_varying_size / sizeof(f32)];
+};
+
+// Extent of the x/y planes relative to the viewport, 1 is the viewport
+// itself. Triangles that only cross the guard band are rasterized as is
+// since the raster bounds are clamped to the screen anyway.
+struct guard_band {
+  f32 x, y;
+};
+
+static inline f32 clip_distance(u32 plane, const math::vec4 &p,
+                                const guard_band &gb) {
+  switch (plane) {
+  case clip_near:
+    return p.z + p.w;
+  case clip_far:
+    return p.w - p.z;
+  case clip_left:
+    return p.x + gb.x * p.w;
+  case clip_right:
+    return gb.x * p.w - p.x;
+  case clip_bottom:
+    return p.y + gb.y * p.w;
+  case clip_top:
+  default:
+    return gb.y * p.w - p.y;
+  }
+}
+
+// planes p is on the outside of
+static inline u32 clip_outcode(const math::vec4 &p, const guard_band &gb) {
+  u32 code = 0;
+  for (u32 i = 0; i < num_clip_planes; ++i) {
+    if (clip_distance(1u << i, p, gb) < 0.f)
+      code |= 1u << i;
+  }
+  return code;
+}
+
+/// <summary>
+/// Sutherland-Hodgman clipping of a convex polygon against the given planes.
+/// Varyings are interpolated linearly in clip space.
+/// </summary>
+/// <param name="verts">Polygon, replaced by the clipped one. Needs room for
+/// max_clip_vertices</param>
+/// <param name="planes">Outcode bits of the planes to clip against</param>
+/// <returns>Vertex count of the clipped polygon, less than 3 if nothing is
+/// left</returns>
+static inline u32 clip_polygon(clip_vertex *verts, u32 count, u32 planes,
+                               const guard_band &gb, u32 varying_floats) {
+  clip_vertex scratch[max_clip_vertices];
+  clip_vertex *in = verts;
+  clip_vertex *out = scratch;
+
+  for (u32 i = 0; i < num_clip_planes && count >= 3; ++i) {
+    u32 plane = 1u << i;
+    if (!(planes & plane))
+      continue;
+
+    u32 out_count = 0;
+    for (u32 v = 0; v < count; ++v) {
+      const clip_vertex &a = in[v];
+      const clip_vertex &b = in[(v + 1) % count];
+      f32 da = clip_distance(plane, a.pos, gb);
+      f32 db = clip_distance(plane, b.pos, gb);
+
+      if (da >= 0.f)
+        out[out_count++] = a;
+
+      // edge crosses the plane
+      if ((da >= 0.f) != (db >= 0.f)) {
+        f32 t = da / (da - db);
+        clip_vertex &c = out[out_count++];
+        c.pos = a.pos + (b.pos - a.pos) * t;
+        for (u32 k = 0; k < varying_floats; ++k)
+          c.vars[k] = a.vars[k] + (b.vars[k] - a.vars[k]) * t;
+      }
+    }
+
+    count = out_count;
+    std::swap(in, out);
+  }
+
+  if (in != verts) {
+    for (u32 v = 0; v < count; ++v)
+      verts[v] = in[v];
+  }
+
+  return count;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "types.hpp"
+
+// Why a triangle never reached the raster stage, or visible if it did.
+enum class cull_result : u8 {
+  visible,
+  frustum,    // entirely outside of one of the view frustum planes
+  clipped,    // nothing left after clipping, or w <= 0 past the near plane
+  invalid,    // NaN or beyond max_raster_coord after the divide
+  degenerate, // zero area once snapped to the sub-pixel grid
+  facing,     // removed by the cull_mode of the pipeline state
+  no_samples, // covers no pixel center
+  scissor,    // outside of the viewport / scissor rectangle
+  count
+};
+
+// Per reason triangle counts, accumulated over draws until reset.
+struct cull_stats {
+  u64 counts[(size)cull_result::count] = {};
+
+  inline void add(cull_result result) { ++counts[(size)result]; }
+  inline u64 get(cull_result result) const { return counts[(size)result]; }
+
+  inline u64 culled() const {
+    u64 total = 0;
+    for (size i = 1; i < (size)cull_result::count; ++i)
+      total += counts[i];
+    return total;
+  }
+
+  inline void reset() { *this = cull_stats{}; }
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "types.hpp"
+
+enum class compare_func : u8 {
+  never,
+  less,
+  less_equal,
+  equal,
+  greater,
+  greater_equal,
+  not_equal,
+  always
+};
+
+struct depth_state {
+  b8 test_enable = false;
+  b8 write_enable = false;
+  compare_func func = compare_func::less;
+};
+
+// min/max of the stored depth values of one hierarchical z block
+struct depth_range {
+  f32 min, max;
+};
+
+static inline b8 depth_compare(compare_func func, f32 z, f32 stored) {
+  switch (func) {
+  case compare_func::never:
+    return false;
+  case compare_func::less:
+    return z < stored;
+  case compare_func::less_equal:
+    return z <= stored;
+  case compare_func::equal:
+    return z == stored;
+  case compare_func::greater:
+    return z > stored;
+  case compare_func::greater_equal:
+    return z >= stored;
+  case compare_func::not_equal:
+    return z != stored;
+  case compare_func::always:
+    return true;
+  }
+  return true;
+}
+
+// compare_func as the set of orderings of z and stored that pass it: bit 0
+// less, bit 1 equal, bit 2 greater. Picked once per draw, so a compare that
+// is only known at runtime is tested without a switch per fragment.
+static inline u32 depth_compare_bits(compare_func func) {
+  switch (func) {
+  case compare_func::never:
+    return 0;
+  case compare_func::less:
+    return 1;
+  case compare_func::less_equal:
+    return 3;
+  case compare_func::equal:
+    return 2;
+  case compare_func::greater:
+    return 4;
+  case compare_func::greater_equal:
+    return 6;
+  case compare_func::not_equal:
+    return 5;
+  case compare_func::always:
+    return 7;
+  }
+  return 7;
+}
+
+static inline b8 depth_compare_bits_pass(u32 bits, f32 z, f32 stored) {
+  u32 order = (u32)(z < stored) | ((u32)(z == stored) << 1) |
+              ((u32)(z > stored) << 2);
+  return (bits & order) != 0;
+}
+
+/// <summary>
+/// Conservative test of a whole block of fragments against the hierarchical
+/// z range of the block.
+/// </summary>
+/// <param name="lo">Smallest depth of any fragment in the block</param>
+/// <param name="hi">Largest depth of any fragment in the block</param>
+/// <returns>false only if no fragment can pass</returns>
+static inline b8 depth_range_may_pass(compare_func func, f32 lo, f32 hi,
+                                      depth_range stored) {
+  switch (func) {
+  case compare_func::never:
+    return false;
+  case compare_func::less:
+    return lo < stored.max;
+  case compare_func::less_equal:
+    return lo <= stored.max;
+  case compare_func::equal:
+    return lo <= stored.max && hi >= stored.min;
+  case compare_func::greater:
+    return hi > stored.min;
+  case compare_func::greater_equal:
+    return hi >= stored.min;
+  case compare_func::not_equal:
+  case compare_func::always:
+    return true;
+  }
+  return true;
+}
+
+// true only if every fragment in [lo, hi] passes, so the per pixel test can
+// be skipped
+static inline b8 depth_range_all_pass(compare_func func, f32 lo, f32 hi,
+                                      depth_range stored) {
+  switch (func) {
+  case compare_func::less:
+    return hi < stored.min;
+  case compare_func::less_equal:
+    return hi <= stored.min;
+  case compare_func::greater:
+    return lo > stored.max;
+  case compare_func::greater_equal:
+    return lo >= stored.max;
+  case compare_func::always:
+    return true;
+  default:
+    return false;
+  }
+}
@@ -1,14 +1,43 @@
 #pragma once
 
 #include "color.hpp"
+#include "depth.hpp"
+#include "profiler.hpp"
 #include "types.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <immintrin.h>
 #include <memory>
 
+// Side length of the pixel blocks tracked by the hierarchical z buffer.
+static constexpr u32 hiz_block_size = 8;
+
+// Side length of the tiles of framebuffer_layout::tiled, the same as the
+// raster tiles so each worker's pixels are one contiguous range.
+static constexpr u32 framebuffer_tile_size = 64;
+static_assert(framebuffer_tile_size % hiz_block_size == 0);
+
+enum class framebuffer_layout : u8 {
+  linear, // row major over the whole buffer
+  tiled,  // row major framebuffer_tile_size tiles, stored one after another
+};
+
+// Samples per pixel of a multisampled framebuffer, the other supported count
+// is 1.
+static constexpr u32 msaa_samples = 4;
+static constexpr u32 msaa_full_mask = (1u << msaa_samples) - 1;
+
+// Multisampled color is stored compressed: a pixel whose samples all hold the
+// same color keeps it in the regular color buffer only. A pixel is expanded
+// into separate sample planes the first time a triangle edge splits it, and
+// is averaged back into one color when the framebuffer is read.
 struct framebuffer {
-  framebuffer(u32 width, u32 height)
-      : width{width}, height{height},
-        color_buffer{std::make_unique<color[]>(width * height)},
-        depth_buffer{std::make_unique<f32[]>(width * height)} {}
+  framebuffer(u32 width, u32 height,
+              framebuffer_layout layout = framebuffer_layout::linear,
+              u32 samples = 1) {
+    reset(width, height, layout, samples);
+  }
 
   void put_pixel(u32 x, u32 y, const color &c) {
     // todo: assertions
@@ -17,31 +46,297 @@ struct framebuffer {
     assert(x >= 0);
     assert(y >= 0);
 
-    color_buffer[y * width + x] = c;
+    color_buffer[index(x, y)] = c;
   }
 
-  color get_pixel(u32 x, u32 y, const color &c) {
+  color get_pixel(u32 x, u32 y, const color &) {
     // todo: assertions
     assert(x < width);
     assert(y < height);
     assert(x >= 0);
     assert(y >= 0);
 
-    return color_buffer[y * width + x];
+    return color_buffer[index(x, y)];
+  }
+
+  // Pixels x.. of row y up to the end of the tile are contiguous, so a span
+  // inside one tile can be written through this.
+  color *pixel_row(u32 x, u32 y) {
+    assert(x < width);
+    assert(y < height);
+
+    return color_buffer + index(x, y);
   }
 
+  // Sample s of a multisampled pixel, sample 0 is the color buffer itself.
+  color get_sample(u32 x, u32 y, u32 s) const {
+    assert(x < width);
+    assert(y < height);
+    assert(s < samples);
+
+    size i = index(x, y);
+    if (s == 0 || !expanded[i])
+      return color_buffer[i];
+    return sample_colors[(s - 1) * storage_size + i];
+  }
+
+  // Writes c to the samples of a multisampled pixel set in mask. Covering
+  // all of them compresses the pixel again.
+  void put_samples(u32 x, u32 y, u32 mask, const color &c) {
+    assert(x < width);
+    assert(y < height);
+
+    size i = index(x, y);
+    if (mask == msaa_full_mask) {
+      color_buffer[i] = c;
+      expanded[i] = 0;
+      return;
+    }
+
+    expand_pixel(i);
+
+    if (mask & 1)
+      color_buffer[i] = c;
+    for (u32 s = 1; s < samples; ++s) {
+      if (mask & (1u << s))
+        sample_colors[(s - 1) * storage_size + i] = c;
+    }
+  }
+
+  // Writes one color per sample set in mask to a multisampled pixel, in
+  // sample order, expanding the pixel.
+  void put_sample_colors(u32 x, u32 y, u32 mask, const color *colors) {
+    assert(x < width);
+    assert(y < height);
+
+    size i = index(x, y);
+    expand_pixel(i);
+
+    if (mask & 1)
+      color_buffer[i] = *colors++;
+    for (u32 s = 1; s < samples; ++s) {
+      if (mask & (1u << s))
+        sample_colors[(s - 1) * storage_size + i] = *colors++;
+    }
+  }
+
+  // true while all samples of the pixel hold the color of sample 0
+  b8 pixel_compressed(u32 x, u32 y) const {
+    return samples == 1 || !expanded[index(x, y)];
+  }
+
+  // Fast clear: only records the value and marks every tile, so it costs
+  // O(tiles). A tile's pixels are written when it is first touched, see
+  // touch_tile, or at readback.
   void clear_color(const color &c) {
-    std::fill(color_buffer.get(), color_buffer.get() + (width * height), c);
+    PROFILE_ZONE("clear_color");
+    color_clear_value = c;
+    for (u32 i = 0; i < num_tiles; ++i)
+      tile_state[i] |= tile_color_pending;
+  }
+
+  /// <summary>
+  /// Copies the color buffer out in row major order, detiling and resolving
+  /// the samples if needed. Tiles still waiting for their clear are written
+  /// straight from the clear value with non-temporal stores.
+  /// </summary>
+  /// <param name="pitch">Bytes between the rows of out, 0 for tightly
+  /// packed rows</param>
+  void read_color(color *out, size pitch = 0) const {
+    PROFILE_ZONE("read_color");
+    if (pitch == 0)
+      pitch = width * sizeof(color);
+
+    constexpr u32 tile = framebuffer_tile_size;
+    for (u32 y = 0; y < height; ++y) {
+      color *dst_row = (color *)((u8 *)out + y * pitch);
+      const u8 *row_state = tile_state.get() + (y / tile) * tiles_x;
+
+      for (u32 tx = 0; tx < tiles_x; ++tx) {
+        u32 x = tx * tile;
+        u32 count = std::min(tile, width - x);
+
+        if (row_state[tx] & tile_color_pending)
+          stream_fill_pixels(dst_row + x, color_clear_value, count);
+        else if (samples > 1)
+          resolve_pixels(dst_row + x, index(x, y), count);
+        else
+          copy_pixels(dst_row + x, color_buffer + index(x, y), count);
+      }
+    }
+
+    _mm_sfence();
+  }
+
+  // true if the color storage holds every pixel, so it can be read directly
+  b8 color_resolved() const {
+    for (u32 i = 0; i < num_tiles; ++i) {
+      if (tile_state[i] & tile_color_pending)
+        return false;
+    }
+    return true;
+  }
+
+  /// <summary>
+  /// Writes the pending clears of a tile (in framebuffer_tile_size tiles, row
+  /// major) into its pixels. put/get_pixel and put/get_depth don't look at
+  /// the clear state, so a tile has to be touched before its pixels are
+  /// accessed directly. The pipeline does this for every tile it rasterizes.
+  /// </summary>
+  inline void touch_tile(u32 tile, b8 touch_color, b8 touch_depth) {
+    u8 mask = (touch_color ? tile_color_pending : 0) |
+              (touch_depth ? tile_depth_pending : 0);
+    u8 pending = tile_state[tile] & mask;
+
+    if (pending)
+      materialize_tile(tile, pending);
+  }
+
+  // writes the pending clears out
+  void resolve(b8 resolve_color = true, b8 resolve_depth = true) {
+    for (u32 i = 0; i < num_tiles; ++i)
+      touch_tile(i, resolve_color, resolve_depth);
+  }
+
+  /// <summary>
+  /// Lets the draws write color straight into external memory, e.g. a locked
+  /// streaming texture, until return_color_storage. The previous contents of
+  /// the memory are used as is, so clear after borrowing and resolve before
+  /// giving the memory back. Linear layout only.
+  /// </summary>
+  /// <param name="pitch">Bytes between the rows of pixels. Depth follows the
+  /// same addressing, it is reset to its clear value when the pitch
+  /// changes</param>
+  void borrow_color_storage(color *pixels, size pitch) {
+    assert(layout == framebuffer_layout::linear);
+    assert(samples == 1);
+    assert(pitch % sizeof(color) == 0 && pitch >= width * sizeof(color));
+
+    set_linear_pitch(pitch / sizeof(color));
+    color_buffer = pixels;
+  }
+
+  void return_color_storage() {
+    set_linear_pitch(width);
+    color_buffer = owned_color.get();
+  }
+
+  // depth is stored for every sample of a pixel
+  void put_depth(u32 x, u32 y, f32 z, u32 sample = 0) {
+    assert(x < width);
+    assert(y < height);
+    assert(sample < samples);
+
+    depth_buffer[index(x, y) * samples + sample] = z;
   }
 
-  inline void reset(u32 width, u32 height) {
+  f32 get_depth(u32 x, u32 y, u32 sample = 0) const {
+    assert(x < width);
+    assert(y < height);
+    assert(sample < samples);
+
+    return depth_buffer[index(x, y) * samples + sample];
+  }
+
+  // Fast clear like clear_color, the hierarchical z of a tile is reset
+  // along with its depth values.
+  void clear_depth(f32 z) {
+    PROFILE_ZONE("clear_depth");
+    depth_clear_value = z;
+    for (u32 i = 0; i < num_tiles; ++i)
+      tile_state[i] |= tile_depth_pending;
+  }
+
+  // depth range of the hiz_block_size x hiz_block_size block at (bx, by),
+  // in block coordinates
+  depth_range get_hiz(u32 bx, u32 by) const {
+    assert(bx < hiz_width);
+    assert(by < hiz_height);
+
+    return hiz_buffer[by * hiz_width + bx];
+  }
+
+  // recomputes the range of a block after its depth values were written
+  void update_hiz(u32 bx, u32 by) {
+    assert(bx < hiz_width);
+    assert(by < hiz_height);
+
+    u32 x0 = bx * hiz_block_size;
+    u32 y0 = by * hiz_block_size;
+    u32 x1 = std::min(x0 + hiz_block_size, width);
+    u32 y1 = std::min(y0 + hiz_block_size, height);
+
+    f32 first = depth_buffer[index(x0, y0) * samples];
+    depth_range range = {first, first};
+    for (u32 y = y0; y < y1; ++y) {
+      // a hiz block never straddles a tile, so its rows (and the samples of
+      // their pixels) are contiguous
+      const f32 *row = depth_buffer.get() + index(x0, y) * samples;
+      for (u32 x = 0; x < (x1 - x0) * samples; ++x) {
+        f32 z = row[x];
+        range.min = std::min(range.min, z);
+        range.max = std::max(range.max, z);
+      }
+    }
+
+    hiz_buffer[by * hiz_width + bx] = range;
+  }
+
+  inline void reset(u32 width, u32 height,
+                    framebuffer_layout layout = framebuffer_layout::linear,
+                    u32 samples = 1) {
+    assert(samples == 1 || samples == msaa_samples);
+
     this->width = width;
     this->height = height;
+    this->layout = layout;
+    this->samples = samples;
+    hiz_width = (width + hiz_block_size - 1) / hiz_block_size;
+    hiz_height = (height + hiz_block_size - 1) / hiz_block_size;
+
+    constexpr u32 tile = framebuffer_tile_size;
+    tiles_x = (width + tile - 1) / tile;
+    tiles_y = (height + tile - 1) / tile;
+    num_tiles = tiles_x * tiles_y;
+
+    // Both layouts share one addressing scheme, see index. Linear is a
+    // single tile as wide as the buffer, which the shifts never leave.
+    if (layout == framebuffer_layout::tiled) {
+      tile_shift = (u32)std::countr_zero(tile);
+      tile_mask = tile - 1;
+      tile_pitch = tile;
+      tile_stride = tile * tile;
+      tile_row_stride = (size)tiles_x * tile * tile;
+      storage_size = (size)tiles_x * tiles_y * tile * tile;
+    } else {
+      tile_shift = 31;
+      tile_mask = ~0u;
+      tile_pitch = width;
+      tile_stride = 0;
+      tile_row_stride = 0;
+      storage_size = (size)width * height;
+    }
 
-    color_buffer = std::make_unique<color[]>(width * height);
-    depth_buffer = std::make_unique<f32[]>(width * height);
+    owned_color = std::make_unique<color[]>(storage_size);
+    color_buffer = owned_color.get();
+    depth_buffer = std::make_unique<f32[]>(storage_size * samples);
+    depth_capacity = storage_size;
+    if (samples > 1) {
+      sample_colors = std::make_unique<color[]>(storage_size * (samples - 1));
+      expanded = std::make_unique<u8[]>(storage_size);
+    } else {
+      sample_colors.reset();
+      expanded.reset();
+    }
+    hiz_buffer = std::make_unique<depth_range[]>(hiz_width * hiz_height);
+    tile_state = std::make_unique<u8[]>(num_tiles);
+
+    clear_color(color{});
+    clear_depth(1.f);
   }
 
+  inline framebuffer_layout get_layout() const { return layout; }
+  inline u32 get_samples() const { return samples; }
   inline u32 get_width() const { return width; }
   inline u32 get_height() const { return height; }
 
@@ -52,7 +347,198 @@ struct framebuffer {
   friend struct window;
 
 private:
+  inline size index(u32 x, u32 y) const {
+    return (size)(y >> tile_shift) * tile_row_stride +
+           (size)(x >> tile_shift) * tile_stride +
+           (size)(y & tile_mask) * tile_pitch + (x & tile_mask);
+  }
+
+  // gives the samples of a compressed pixel their own storage
+  inline void expand_pixel(size i) {
+    if (expanded[i])
+      return;
+
+    for (u32 s = 1; s < samples; ++s)
+      sample_colors[(s - 1) * storage_size + i] = color_buffer[i];
+    expanded[i] = 1;
+  }
+
+  // Linear addressing with pitch pixels per row. Depth values keep their
+  // index, not their pixel, so a new pitch resets them.
+  void set_linear_pitch(size pitch) {
+    if (pitch == tile_pitch)
+      return;
+
+    tile_pitch = pitch;
+    storage_size = pitch * height;
+    if (storage_size > depth_capacity) {
+      depth_buffer = std::make_unique<f32[]>(storage_size);
+      depth_capacity = storage_size;
+    }
+
+    for (u32 i = 0; i < num_tiles; ++i)
+      tile_state[i] |= tile_depth_pending;
+  }
+
+  // writes the clears in pending (tile_*_pending bits) over a tile
+  void materialize_tile(u32 tile, u8 pending) {
+    constexpr u32 extent = framebuffer_tile_size;
+    u32 x0 = (tile % tiles_x) * extent;
+    u32 y0 = (tile / tiles_x) * extent;
+    u32 x1 = std::min(x0 + extent, width);
+    u32 y1 = std::min(y0 + extent, height);
+
+    for (u32 y = y0; y < y1; ++y) {
+      size row = index(x0, y);
+      if (pending & tile_color_pending) {
+        std::fill_n(color_buffer + row, x1 - x0, color_clear_value);
+        if (samples > 1)
+          std::fill_n(expanded.get() + row, x1 - x0, (u8)0);
+      }
+      if (pending & tile_depth_pending) {
+        std::fill_n(depth_buffer.get() + row * samples, (x1 - x0) * samples,
+                    depth_clear_value);
+      }
+    }
+
+    if (pending & tile_depth_pending) {
+      depth_range range = {depth_clear_value, depth_clear_value};
+      for (u32 by = y0 / hiz_block_size; by * hiz_block_size < y1; ++by) {
+        for (u32 bx = x0 / hiz_block_size; bx * hiz_block_size < x1; ++bx)
+          hiz_buffer[by * hiz_width + bx] = range;
+      }
+    }
+
+    tile_state[tile] &= ~pending;
+  }
+
+  // Fills count pixels with c without pulling dst into the cache, the
+  // readback target isn't read again by us.
+  static inline void stream_fill_pixels(color *dst, color c, u32 count) {
+    u32 i = 0;
+    for (; i < count && ((uintptr_t)(dst + i) & 15); ++i)
+      dst[i] = c;
+
+    u32 bits;
+    std::memcpy(&bits, &c, sizeof(bits));
+    __m128i v = _mm_set1_epi32((i32)bits);
+    for (; i + 4 <= count; i += 4)
+      _mm_stream_si128((__m128i *)(dst + i), v);
+
+    for (; i < count; ++i)
+      dst[i] = c;
+  }
+
+  // Averages the samples of count pixels starting at storage index i, up to
+  // one tile row. Compressed pixels are copied as they are.
+  inline void resolve_pixels(color *dst, size i, u32 count) const {
+    const color *s0 = color_buffer + i;
+    const color *s1 = sample_colors.get() + i;
+    const color *s2 = s1 + storage_size;
+    const color *s3 = s2 + storage_size;
+    const u8 *flags = expanded.get() + i;
+
+    u32 n = 0;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(2);
+    for (; n + 4 <= count; n += 4) {
+      __m128i c0 = _mm_loadu_si128((const __m128i *)(s0 + n));
+
+      u32 f;
+      std::memcpy(&f, flags + n, sizeof(f));
+      if (f == 0) {
+        _mm_storeu_si128((__m128i *)(dst + n), c0);
+        continue;
+      }
+
+      __m128i c1 = _mm_loadu_si128((const __m128i *)(s1 + n));
+      __m128i c2 = _mm_loadu_si128((const __m128i *)(s2 + n));
+      __m128i c3 = _mm_loadu_si128((const __m128i *)(s3 + n));
+
+      // (c0 + c1 + c2 + c3 + 2) / 4 per channel in 16 bit lanes
+      __m128i lo = _mm_add_epi16(
+          _mm_add_epi16(_mm_unpacklo_epi8(c0, zero),
+                        _mm_unpacklo_epi8(c1, zero)),
+          _mm_add_epi16(_mm_unpacklo_epi8(c2, zero),
+                        _mm_unpacklo_epi8(c3, zero)));
+      __m128i hi = _mm_add_epi16(
+          _mm_add_epi16(_mm_unpackhi_epi8(c0, zero),
+                        _mm_unpackhi_epi8(c1, zero)),
+          _mm_add_epi16(_mm_unpackhi_epi8(c2, zero),
+                        _mm_unpackhi_epi8(c3, zero)));
+      lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 2);
+      hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 2);
+      __m128i avg = _mm_packus_epi16(lo, hi);
+
+      // the sample planes of compressed pixels are stale, keep sample 0
+      __m128i expand = _mm_cvtsi32_si128((i32)f);
+      expand = _mm_unpacklo_epi8(expand, expand);
+      expand = _mm_unpacklo_epi16(expand, expand);
+      expand = _mm_cmpgt_epi32(expand, zero);
+      __m128i out = _mm_or_si128(_mm_and_si128(expand, avg),
+                                 _mm_andnot_si128(expand, c0));
+      _mm_storeu_si128((__m128i *)(dst + n), out);
+    }
+
+    for (; n < count; ++n) {
+      if (!flags[n]) {
+        dst[n] = s0[n];
+        continue;
+      }
+
+      const u8 *c[4] = {(const u8 *)(s0 + n), (const u8 *)(s1 + n),
+                        (const u8 *)(s2 + n), (const u8 *)(s3 + n)};
+      u8 *out = (u8 *)(dst + n);
+      for (u32 k = 0; k < sizeof(color); ++k)
+        out[k] = (u8)((c[0][k] + c[1][k] + c[2][k] + c[3][k] + 2) / 4);
+    }
+  }
+
+  // count pixels, up to one tile row
+  static inline void copy_pixels(color *dst, const color *src, u32 count) {
+    u32 i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= count; i += 8) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+      _mm256_storeu_si256((__m256i *)(dst + i), v);
+    }
+#endif
+    for (; i + 4 <= count; i += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+      _mm_storeu_si128((__m128i *)(dst + i), v);
+    }
+    for (; i < count; ++i)
+      dst[i] = src[i];
+  }
+
   u32 width, height;
-  std::unique_ptr<color[]> color_buffer;
-  std::unique_ptr<f32[]> depth_buffer;
+  framebuffer_layout layout;
+  u32 samples;
+
+  // addressing, see index
+  u32 tile_shift, tile_mask;
+  size tile_pitch, tile_stride, tile_row_stride;
+  size storage_size;
+
+  u32 hiz_width, hiz_height;
+
+  // fast clear state, one entry per framebuffer_tile_size tile
+  static constexpr u8 tile_color_pending = 1;
+  static constexpr u8 tile_depth_pending = 2;
+  u32 tiles_x, tiles_y, num_tiles;
+  color color_clear_value;
+  f32 depth_clear_value;
+  std::unique_ptr<u8[]> tile_state;
+
+  // color_buffer is owned_color unless external storage is borrowed
+  color *color_buffer;
+  std::unique_ptr<color[]> owned_color;
+  std::unique_ptr<f32[]> depth_buffer; // samples values per pixel
+  size depth_capacity;
+
+  // multisampled only: samples 1.. in planes of storage_size pixels each,
+  // valid for pixels whose expanded flag is set
+  std::unique_ptr<color[]> sample_colors;
+  std::unique_ptr<u8[]> expanded;
+  std::unique_ptr<depth_range[]> hiz_buffer;
 };
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include "image_io.hpp"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace image_io {
+b8 write_ppm(const char *path, const color *pixels, u32 width, u32 height) {
+  FILE *file = std::fopen(path, "wb");
+  if (!file)
+    return false;
+
+  std::fprintf(file, "P6\n%u %u\n255\n", width, height);
+
+  std::vector<u8> row(width * 3);
+  for (u32 y = 0; y < height; ++y) {
+    for (u32 x = 0; x < width; ++x) {
+      const color &c = pixels[y * width + x];
+      row[x * 3 + 0] = c.r;
+      row[x * 3 + 1] = c.g;
+      row[x * 3 + 2] = c.b;
+    }
+    std::fwrite(row.data(), 1, row.size(), file);
+  }
+
+  b8 ok = !std::ferror(file);
+  std::fclose(file);
+  return ok;
+}
+
+static u32 crc32(const u8 *data, size count, u32 crc = 0) {
+  static u32 table[256];
+  static b8 table_ready = false;
+
+  if (!table_ready) {
+    for (u32 n = 0; n < 256; ++n) {
+      u32 c = n;
+      for (i32 k = 0; k < 8; ++k)
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      table[n] = c;
+    }
+    table_ready = true;
+  }
+
+  crc = ~crc;
+  for (size i = 0; i < count; ++i)
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static u32 adler32(const u8 *data, size count) {
+  u32 a = 1, b = 0;
+  for (size i = 0; i < count; ++i) {
+    a = (a + data[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  return (b << 16) | a;
+}
+
+static void put_u32_be(std::vector<u8> &out, u32 v) {
+  out.push_back((u8)(v >> 24));
+  out.push_back((u8)(v >> 16));
+  out.push_back((u8)(v >> 8));
+  out.push_back((u8)v);
+}
+
+static void write_chunk(FILE *file, const char type[4],
+                        const std::vector<u8> &data) {
+  std::vector<u8> chunk;
+  chunk.reserve(data.size() + 12);
+  put_u32_be(chunk, (u32)data.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  // the crc covers type and data, not the length
+  put_u32_be(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+
+  std::fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+b8 write_png(const char *path, const color *pixels, u32 width, u32 height) {
+  FILE *file = std::fopen(path, "wb");
+  if (!file)
+    return false;
+
+  static const u8 signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  std::fwrite(signature, 1, sizeof(signature), file);
+
+  std::vector<u8> header;
+  put_u32_be(header, width);
+  put_u32_be(header, height);
+  header.push_back(8); // bits per channel
+  header.push_back(6); // RGBA
+  header.push_back(0); // deflate
+  header.push_back(0); // adaptive filtering
+  header.push_back(0); // no interlace
+  write_chunk(file, "IHDR", header);
+
+  // scanlines, each led by filter type 0 (none)
+  size row_size = (size)width * sizeof(color);
+  std::vector<u8> raw((row_size + 1) * height);
+  for (u32 y = 0; y < height; ++y) {
+    u8 *row = raw.data() + y * (row_size + 1);
+    row[0] = 0;
+    std::memcpy(row + 1, pixels + (size)y * width, row_size);
+  }
+
+  // zlib stream made of stored deflate blocks
+  constexpr size max_block = 65535;
+  std::vector<u8> zlib = {0x78, 0x01};
+  zlib.reserve(raw.size() + raw.size() / max_block * 5 + 16);
+
+  size offset = 0;
+  do {
+    size count = std::min(raw.size() - offset, max_block);
+    b8 last = offset + count == raw.size();
+
+    zlib.push_back(last ? 1 : 0);
+    zlib.push_back((u8)count);
+    zlib.push_back((u8)(count >> 8));
+    zlib.push_back((u8)~count);
+    zlib.push_back((u8)(~count >> 8));
+    zlib.insert(zlib.end(), raw.begin() + offset,
+                raw.begin() + offset + count);
+
+    offset += count;
+  } while (offset < raw.size());
+
+  put_u32_be(zlib, adler32(raw.data(), raw.size()));
+  write_chunk(file, "IDAT", zlib);
+  write_chunk(file, "IEND", {});
+
+  b8 ok = !std::ferror(file);
+  std::fclose(file);
+  return ok;
+}
+
+b8 write_image(const char *path, const color *pixels, u32 width, u32 height) {
+  std::string_view name = path;
+  if (name.ends_with(".ppm"))
+    return write_ppm(path, pixels, width, height);
+  return write_png(path, pixels, width, height);
+}
+} // namespace image_io
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "color.hpp"
+#include "types.hpp"
+#include <string_view>
+
+namespace image_io {
+// Binary PPM (P6), alpha is dropped.
+b8 write_ppm(const char *path, const color *pixels, u32 width, u32 height);
+
+// 8 bit RGBA PNG. The image data is stored uncompressed, which keeps the
+// writer free of dependencies at the cost of file size.
+b8 write_png(const char *path, const color *pixels, u32 width, u32 height);
+
+// Picks the format from the extension of path, PNG unless it ends in .ppm.
+b8 write_image(const char *path, const color *pixels, u32 width, u32 height);
+} // namespace image_io
@@ -2,10 +2,18 @@
 #include "framebuffer.hpp"
 #include "matrix.hpp"
 #include "renderer.hpp"
+#include "swap_chain.hpp"
 #include "timer.hpp"
 #include "window.hpp"
+#include <cstring>
 #include <numbers>
 #include <print>
+#include <thread>
+
+// 2 buffers for double buffering, 3 for triple. fifo presents every frame,
+// mailbox trades dropped frames for latency, see present_mode.
+static constexpr u32 frames_in_flight = 2;
+static constexpr present_mode frame_present_mode = present_mode::fifo;
 
 static b8 running = true;
 static f32 total_time;
@@ -45,50 +53,123 @@ static void render(rendering_pipeline &pipeline) {
       {math::vec3{-0.5f, -0.5f, 0.f}, math::vec4{1, 0, 0, 1}}, // bottom-left
       {math::vec3{0.5f, -0.5f, 0.f}, math::vec4{0, 1, 0, 1}},  // bottom-right
       {math::vec3{-0.5f, 0.5f, 0.f}, math::vec4{0, 0, 1, 1}},  // top-left
-      {math::vec3{0.5f, -0.5f, 0.f}, math::vec4{0, 1, 0, 1}},  // bottom-right
       {math::vec3{0.5f, 0.5f, 0.f}, math::vec4{0, 0, 1, 1}},   // top-right
-      {math::vec3{-0.5f, 0.5f, 0.f}, math::vec4{0, 0, 1, 1}},  // top-left
   };
 
+  u16 indices[] = {0, 1, 2, 1, 3, 2};
+
   vertex_buffer vbuf(mesh, sizeof(vertex));
+  index_buffer ibuf(indices);
 
-  pipeline.execute_pipeline(&program, vbuf, 6);
+  pipeline.draw_indexed(&program, vbuf, ibuf, 6);
+}
+
+// depth tested, back faces culled
+static pipeline_state scene_state() {
+  pipeline_state state;
+  state.depth.test_enable = true;
+  state.depth.write_enable = true;
+  state.cull = cull_mode::back;
+  return state;
 }
 
 static void update(f32 dt) { std::println("FPS = {}", 1.f / dt); }
 
-int main(int argc, char *argv[]) {
+// Draws frames into the swap chain until it is closed. SDL wants the window
+// on the main thread, so rendering is the part that moves off it.
+static void render_thread(swap_chain &chain) {
+  framebuffer *fb = chain.acquire();
+  if (!fb)
+    return;
 
-  window wnd;
-  b8 ok = wnd.init("Software Rasterizer", 800, 600);
+  rendering_pipeline pipeline(*fb);
+  pipeline.set_pipeline_state(scene_state());
+  struct timer timer;
 
-  if (!ok) {
-    std::println("Failed to Initialize Window!");
-    return 1;
+  while (fb) {
+    f32 dt = timer.get_elapsed_s();
+    total_time += dt;
+    update(dt);
+
+    pipeline.set_render_target(*fb);
+    fb->clear_color(colors::black);
+    fb->clear_depth(1.f);
+    render(pipeline);
+
+    chain.submit(fb);
+    fb = chain.acquire();
   }
+}
 
-  event::register_callback([&](event::Event event) {
-    if (event.type == event::EventType::AppQuit) {
-      running = false;
+static void run_swap_chain(window &wnd) {
+  swap_chain chain(800, 600, frames_in_flight, frame_present_mode);
+  std::thread renderer(render_thread, std::ref(chain));
+
+  // presents frame N while the render thread draws N + 1, waking up at least
+  // every few ms to keep handling events
+  while (running) {
+    wnd.process_events();
+
+    framebuffer *fb = chain.acquire_present(std::chrono::milliseconds(5));
+    if (fb) {
+      wnd.display_framebuffer(*fb);
+      chain.release(fb);
     }
-  });
+  }
 
-  framebuffer fb(800, 600);
+  chain.close();
+  renderer.join();
+}
 
-  // renderer rnd(fb);
+// Draws straight into the window's texture memory on the main thread
+// instead, which saves the upload copy but doesn't overlap present.
+static void run_zero_copy(window &wnd) {
+  framebuffer fb(800, 600);
   rendering_pipeline pipeline(fb);
-
+  pipeline.set_pipeline_state(scene_state());
   struct timer timer;
 
   while (running) {
     wnd.process_events();
+    if (!wnd.begin_frame(fb))
+      break;
+
     f32 dt = timer.get_elapsed_s();
     total_time += dt;
     update(dt);
     fb.clear_color(colors::black);
+    fb.clear_depth(1.f);
     render(pipeline);
-    wnd.display_framebuffer(fb);
+    wnd.present_frame(fb);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  // --zero-copy presents through run_zero_copy instead of the swap chain
+  b8 zero_copy_present = false;
+  for (int i = 1; i < argc; ++i) {
+    if (!std::strcmp(argv[i], "--zero-copy"))
+      zero_copy_present = true;
+  }
+
+  window wnd;
+  b8 ok = wnd.init("Software Rasterizer", 800, 600);
+
+  if (!ok) {
+    std::println("Failed to Initialize Window!");
+    return 1;
   }
 
+  event::register_callback([&](event::Event event) {
+    if (event.type == event::EventType::AppQuit) {
+      running = false;
+    }
+  });
+
+  if (zero_copy_present)
+    run_zero_copy(wnd);
+  else
+    run_swap_chain(wnd);
+
   return 0;
 }
\ No newline at end of file
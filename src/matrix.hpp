@@ -3,10 +3,13 @@
 #include "vector.hpp"
 #include <algorithm>
 #include <cmath>
+#include <immintrin.h>
 #include <initializer_list>
 
 namespace math {
-struct mat4 {
+// Column major, element (row, col) is values[col * 4 + row]. Aligned so a
+// column loads as one __m128.
+struct alignas(16) mat4 {
   f32 values[16];
 
   mat4() = default;
@@ -15,6 +18,17 @@ struct mat4 {
     std::copy(list.begin(), list.end(), values);
   }
 
+  static mat4 from_columns(__m128 c0, __m128 c1, __m128 c2, __m128 c3) {
+    mat4 m;
+    _mm_store_ps(m.values, c0);
+    _mm_store_ps(m.values + 4, c1);
+    _mm_store_ps(m.values + 8, c2);
+    _mm_store_ps(m.values + 12, c3);
+    return m;
+  }
+
+  inline __m128 column(i32 i) const { return _mm_load_ps(values + i * 4); }
+
   static mat4 identity() {
     return mat4{1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f,
                 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f};
@@ -141,7 +155,10 @@ struct mat4 {
   }
 };
 
-static inline vec4 operator*(const mat4 &m, const vec4 &v) {
+// Scalar versions of the SIMD kernels below, kept as the reference they are
+// checked against.
+namespace reference {
+static inline vec4 mul(const mat4 &m, const vec4 &v) {
   vec4 result;
   result.x = m.values[0] * v.x + m.values[4] * v.y + m.values[8] * v.z +
              m.values[12] * v.w;
@@ -154,7 +171,7 @@ static inline vec4 operator*(const mat4 &m, const vec4 &v) {
   return result;
 }
 
-static inline mat4 operator*(const mat4 &A, const mat4 &B) {
+static inline mat4 mul(const mat4 &A, const mat4 &B) {
   mat4 R{};
   for (i32 col = 0; col < 4; ++col) {
     for (i32 row = 0; row < 4; ++row) {
@@ -167,4 +184,249 @@ static inline mat4 operator*(const mat4 &A, const mat4 &B) {
   }
   return R;
 }
+
+static inline mat4 transpose(const mat4 &m) {
+  mat4 R;
+  for (i32 col = 0; col < 4; ++col) {
+    for (i32 row = 0; row < 4; ++row)
+      R.values[row * 4 + col] = m.values[col * 4 + row];
+  }
+  return R;
+}
+
+// Cofactor expansion. A singular matrix gives infinities or NaNs.
+static inline mat4 inverse(const mat4 &m) {
+  const f32 *a = m.values;
+  mat4 R;
+  f32 *r = R.values;
+
+  r[0] = a[5] * a[10] * a[15] - a[5] * a[11] * a[14] - a[9] * a[6] * a[15] +
+         a[9] * a[7] * a[14] + a[13] * a[6] * a[11] - a[13] * a[7] * a[10];
+  r[4] = -a[4] * a[10] * a[15] + a[4] * a[11] * a[14] + a[8] * a[6] * a[15] -
+         a[8] * a[7] * a[14] - a[12] * a[6] * a[11] + a[12] * a[7] * a[10];
+  r[8] = a[4] * a[9] * a[15] - a[4] * a[11] * a[13] - a[8] * a[5] * a[15] +
+         a[8] * a[7] * a[13] + a[12] * a[5] * a[11] - a[12] * a[7] * a[9];
+  r[12] = -a[4] * a[9] * a[14] + a[4] * a[10] * a[13] + a[8] * a[5] * a[14] -
+          a[8] * a[6] * a[13] - a[12] * a[5] * a[10] + a[12] * a[6] * a[9];
+  r[1] = -a[1] * a[10] * a[15] + a[1] * a[11] * a[14] + a[9] * a[2] * a[15] -
+         a[9] * a[3] * a[14] - a[13] * a[2] * a[11] + a[13] * a[3] * a[10];
+  r[5] = a[0] * a[10] * a[15] - a[0] * a[11] * a[14] - a[8] * a[2] * a[15] +
+         a[8] * a[3] * a[14] + a[12] * a[2] * a[11] - a[12] * a[3] * a[10];
+  r[9] = -a[0] * a[9] * a[15] + a[0] * a[11] * a[13] + a[8] * a[1] * a[15] -
+         a[8] * a[3] * a[13] - a[12] * a[1] * a[11] + a[12] * a[3] * a[9];
+  r[13] = a[0] * a[9] * a[14] - a[0] * a[10] * a[13] - a[8] * a[1] * a[14] +
+          a[8] * a[2] * a[13] + a[12] * a[1] * a[10] - a[12] * a[2] * a[9];
+  r[2] = a[1] * a[6] * a[15] - a[1] * a[7] * a[14] - a[5] * a[2] * a[15] +
+         a[5] * a[3] * a[14] + a[13] * a[2] * a[7] - a[13] * a[3] * a[6];
+  r[6] = -a[0] * a[6] * a[15] + a[0] * a[7] * a[14] + a[4] * a[2] * a[15] -
+         a[4] * a[3] * a[14] - a[12] * a[2] * a[7] + a[12] * a[3] * a[6];
+  r[10] = a[0] * a[5] * a[15] - a[0] * a[7] * a[13] - a[4] * a[1] * a[15] +
+          a[4] * a[3] * a[13] + a[12] * a[1] * a[7] - a[12] * a[3] * a[5];
+  r[14] = -a[0] * a[5] * a[14] + a[0] * a[6] * a[13] + a[4] * a[1] * a[14] -
+          a[4] * a[2] * a[13] - a[12] * a[1] * a[6] + a[12] * a[2] * a[5];
+  r[3] = -a[1] * a[6] * a[11] + a[1] * a[7] * a[10] + a[5] * a[2] * a[11] -
+         a[5] * a[3] * a[10] - a[9] * a[2] * a[7] + a[9] * a[3] * a[6];
+  r[7] = a[0] * a[6] * a[11] - a[0] * a[7] * a[10] - a[4] * a[2] * a[11] +
+         a[4] * a[3] * a[10] + a[8] * a[2] * a[7] - a[8] * a[3] * a[6];
+  r[11] = -a[0] * a[5] * a[11] + a[0] * a[7] * a[9] + a[4] * a[1] * a[11] -
+          a[4] * a[3] * a[9] - a[8] * a[1] * a[7] + a[8] * a[3] * a[5];
+  r[15] = a[0] * a[5] * a[10] - a[0] * a[6] * a[9] - a[4] * a[1] * a[10] +
+          a[4] * a[2] * a[9] + a[8] * a[1] * a[6] - a[8] * a[2] * a[5];
+
+  f32 inv_det = 1.f / (a[0] * r[0] + a[1] * r[4] + a[2] * r[8] + a[3] * r[12]);
+  for (i32 i = 0; i < 16; ++i)
+    r[i] *= inv_det;
+  return R;
+}
+} // namespace reference
+
+// Columns are loaded as one __m128 each, m * v is a sum of columns scaled by
+// the components of v.
+static inline vec4 operator*(const mat4 &m, const vec4 &v) {
+  __m128 r = _mm_mul_ps(m.column(0), _mm_set1_ps(v.x));
+  r = _mm_add_ps(r, _mm_mul_ps(m.column(1), _mm_set1_ps(v.y)));
+  r = _mm_add_ps(r, _mm_mul_ps(m.column(2), _mm_set1_ps(v.z)));
+  r = _mm_add_ps(r, _mm_mul_ps(m.column(3), _mm_set1_ps(v.w)));
+
+  vec4 result;
+  result._v = r;
+  return result;
+}
+
+static inline mat4 operator*(const mat4 &A, const mat4 &B) {
+  __m128 a[4] = {A.column(0), A.column(1), A.column(2), A.column(3)};
+
+  mat4 R;
+  for (i32 col = 0; col < 4; ++col) {
+    const f32 *b = B.values + col * 4;
+    __m128 r = _mm_mul_ps(a[0], _mm_set1_ps(b[0]));
+    r = _mm_add_ps(r, _mm_mul_ps(a[1], _mm_set1_ps(b[1])));
+    r = _mm_add_ps(r, _mm_mul_ps(a[2], _mm_set1_ps(b[2])));
+    r = _mm_add_ps(r, _mm_mul_ps(a[3], _mm_set1_ps(b[3])));
+    _mm_store_ps(R.values + col * 4, r);
+  }
+  return R;
+}
+
+static inline mat4 transpose(const mat4 &m) {
+  __m128 c0 = m.column(0), c1 = m.column(1);
+  __m128 c2 = m.column(2), c3 = m.column(3);
+  _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+  return mat4::from_columns(c0, c1, c2, c3);
+}
+
+namespace mat4_detail {
+template <i32 X, i32 Y, i32 Z, i32 W> static inline __m128 swizzle(__m128 v) {
+  return _mm_shuffle_ps(v, v, _MM_SHUFFLE(W, Z, Y, X));
+}
+
+// Products of 2x2 matrices stored as (m00, m01, m10, m11) in one __m128:
+// a * b, adj(a) * b and a * adj(b).
+static inline __m128 mat2_mul(__m128 a, __m128 b) {
+  return _mm_add_ps(_mm_mul_ps(a, swizzle<0, 3, 0, 3>(b)),
+                    _mm_mul_ps(swizzle<1, 0, 3, 2>(a), swizzle<2, 1, 2, 1>(b)));
+}
+static inline __m128 mat2_adj_mul(__m128 a, __m128 b) {
+  return _mm_sub_ps(_mm_mul_ps(swizzle<3, 3, 0, 0>(a), b),
+                    _mm_mul_ps(swizzle<1, 1, 2, 2>(a), swizzle<2, 3, 0, 1>(b)));
+}
+static inline __m128 mat2_mul_adj(__m128 a, __m128 b) {
+  return _mm_sub_ps(_mm_mul_ps(a, swizzle<3, 0, 3, 0>(b)),
+                    _mm_mul_ps(swizzle<1, 0, 3, 2>(a), swizzle<2, 1, 2, 1>(b)));
+}
+} // namespace mat4_detail
+
+// Block wise inverse through the 2x2 sub matrices and their adjugates. The
+// inverse of the transpose is the transpose of the inverse, so it works on
+// the columns the same as on rows. A singular matrix gives infinities or
+// NaNs.
+static inline mat4 inverse(const mat4 &m) {
+  using namespace mat4_detail;
+  __m128 c0 = m.column(0), c1 = m.column(1);
+  __m128 c2 = m.column(2), c3 = m.column(3);
+
+  // the four 2x2 blocks
+  __m128 A = _mm_movelh_ps(c0, c1);
+  __m128 B = _mm_movehl_ps(c1, c0);
+  __m128 C = _mm_movelh_ps(c2, c3);
+  __m128 D = _mm_movehl_ps(c3, c2);
+
+  // (det A, det B, det C, det D)
+  __m128 det_sub = _mm_sub_ps(
+      _mm_mul_ps(_mm_shuffle_ps(c0, c2, _MM_SHUFFLE(2, 0, 2, 0)),
+                 _mm_shuffle_ps(c1, c3, _MM_SHUFFLE(3, 1, 3, 1))),
+      _mm_mul_ps(_mm_shuffle_ps(c0, c2, _MM_SHUFFLE(3, 1, 3, 1)),
+                 _mm_shuffle_ps(c1, c3, _MM_SHUFFLE(2, 0, 2, 0))));
+  __m128 det_a = swizzle<0, 0, 0, 0>(det_sub);
+  __m128 det_b = swizzle<1, 1, 1, 1>(det_sub);
+  __m128 det_c = swizzle<2, 2, 2, 2>(det_sub);
+  __m128 det_d = swizzle<3, 3, 3, 3>(det_sub);
+
+  __m128 d_c = mat2_adj_mul(D, C);
+  __m128 a_b = mat2_adj_mul(A, B);
+
+  // adjugates of the blocks of the inverse, before the 1 / det
+  __m128 X = _mm_sub_ps(_mm_mul_ps(det_d, A), mat2_mul(B, d_c));
+  __m128 W = _mm_sub_ps(_mm_mul_ps(det_a, D), mat2_mul(C, a_b));
+  __m128 Y = _mm_sub_ps(_mm_mul_ps(det_b, C), mat2_mul_adj(D, a_b));
+  __m128 Z = _mm_sub_ps(_mm_mul_ps(det_c, B), mat2_mul_adj(A, d_c));
+
+  // det M = det A * det D + det B * det C - tr(adj(A) B adj(D) C)
+  __m128 tr = _mm_mul_ps(a_b, swizzle<0, 2, 1, 3>(d_c));
+  tr = _mm_add_ps(tr, swizzle<2, 3, 0, 1>(tr));
+  tr = _mm_add_ps(tr, swizzle<1, 0, 3, 2>(tr));
+  __m128 det =
+      _mm_sub_ps(_mm_add_ps(_mm_mul_ps(det_a, det_d), _mm_mul_ps(det_b, det_c)),
+                 tr);
+
+  __m128 inv_det = _mm_div_ps(_mm_setr_ps(1.f, -1.f, -1.f, 1.f), det);
+  X = _mm_mul_ps(X, inv_det);
+  Y = _mm_mul_ps(Y, inv_det);
+  Z = _mm_mul_ps(Z, inv_det);
+  W = _mm_mul_ps(W, inv_det);
+
+  // the adjugate swizzle and the block layout in one shuffle per column
+  return mat4::from_columns(_mm_shuffle_ps(X, Y, _MM_SHUFFLE(1, 3, 1, 3)),
+                            _mm_shuffle_ps(X, Y, _MM_SHUFFLE(0, 2, 0, 2)),
+                            _mm_shuffle_ps(Z, W, _MM_SHUFFLE(1, 3, 1, 3)),
+                            _mm_shuffle_ps(Z, W, _MM_SHUFFLE(0, 2, 0, 2)));
+}
+
+// count points in structure of arrays form, one stream per component. w
+// may be nullptr on input for points with w = 1.
+struct soa_points_in {
+  const f32 *x, *y, *z, *w;
+};
+struct soa_points_out {
+  f32 *x, *y, *z, *w;
+};
+
+namespace reference {
+static inline void transform_points(const mat4 &m, const soa_points_in &in,
+                                    const soa_points_out &out, size count) {
+  for (size i = 0; i < count; ++i) {
+    vec4 p = mul(m, vec4{in.x[i], in.y[i], in.z[i], in.w ? in.w[i] : 1.f});
+    out.x[i] = p.x;
+    out.y[i] = p.y;
+    out.z[i] = p.z;
+    out.w[i] = p.w;
+  }
+}
+} // namespace reference
+
+/// <summary>
+/// Transforms count points by m, 8 (AVX2) or 4 (SSE) at a time. Every
+/// matrix element is broadcast once for the whole batch.
+/// </summary>
+static inline void transform_points(const mat4 &m, const soa_points_in &in,
+                                    const soa_points_out &out, size count) {
+  const f32 *e = m.values;
+  f32 *dst[4] = {out.x, out.y, out.z, out.w};
+  size i = 0;
+
+#if defined(__AVX2__)
+  __m256 me[16];
+  for (i32 k = 0; k < 16; ++k)
+    me[k] = _mm256_set1_ps(e[k]);
+
+  for (; i + 8 <= count; i += 8) {
+    __m256 x = _mm256_loadu_ps(in.x + i);
+    __m256 y = _mm256_loadu_ps(in.y + i);
+    __m256 z = _mm256_loadu_ps(in.z + i);
+    __m256 w = in.w ? _mm256_loadu_ps(in.w + i) : _mm256_set1_ps(1.f);
+
+    for (i32 row = 0; row < 4; ++row) {
+      __m256 r = _mm256_mul_ps(me[row], x);
+      r = _mm256_fmadd_ps(me[4 + row], y, r);
+      r = _mm256_fmadd_ps(me[8 + row], z, r);
+      r = _mm256_fmadd_ps(me[12 + row], w, r);
+      _mm256_storeu_ps(dst[row] + i, r);
+    }
+  }
+#endif
+
+  __m128 ms[16];
+  for (i32 k = 0; k < 16; ++k)
+    ms[k] = _mm_set1_ps(e[k]);
+
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_loadu_ps(in.x + i);
+    __m128 y = _mm_loadu_ps(in.y + i);
+    __m128 z = _mm_loadu_ps(in.z + i);
+    __m128 w = in.w ? _mm_loadu_ps(in.w + i) : _mm_set1_ps(1.f);
+
+    for (i32 row = 0; row < 4; ++row) {
+      __m128 r = _mm_mul_ps(ms[row], x);
+      r = _mm_add_ps(r, _mm_mul_ps(ms[4 + row], y));
+      r = _mm_add_ps(r, _mm_mul_ps(ms[8 + row], z));
+      r = _mm_add_ps(r, _mm_mul_ps(ms[12 + row], w));
+      _mm_storeu_ps(dst[row] + i, r);
+    }
+  }
+
+  soa_points_in tail_in = {in.x + i, in.y + i, in.z + i,
+                           in.w ? in.w + i : nullptr};
+  soa_points_out tail_out = {out.x + i, out.y + i, out.z + i, out.w + i};
+  reference::transform_points(m, tail_in, tail_out, count - i);
+}
 } // namespace math
\ No newline at end of file
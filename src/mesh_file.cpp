@@ -0,0 +1,242 @@
+#include "mesh_file.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// the header is read in place from the mapped file
+static_assert(sizeof(mesh_file_header) == 128);
+static_assert(std::is_trivially_copyable_v<mesh_file_header>);
+
+static u64 align_up(u64 v, u64 alignment) {
+  return (v + alignment - 1) & ~(alignment - 1);
+}
+
+static u32 index_size(index_format format) {
+  return format == index_format::u16 ? sizeof(u16) : sizeof(u32);
+}
+
+// Everything open relies on, so a truncated or foreign file fails there
+// instead of faulting in a draw.
+static b8 validate(const mesh_file_header &h, size file_size) {
+  if (h.magic != mesh_file_magic || h.version != mesh_file_version)
+    return false;
+  if (h.file_size != file_size || h.attribute_count == 0 ||
+      h.attribute_count > max_vertex_attributes)
+    return false;
+  if (h.indices != index_format::u16 && h.indices != index_format::u32)
+    return false;
+  if (h.vertex_offset % mesh_file_alignment ||
+      h.index_offset % mesh_file_alignment)
+    return false;
+
+  // the offsets come from the file, so they are only ever subtracted from
+  // to keep a crafted header from wrapping the sums around
+  u64 vertex_bytes = (u64)h.vertex_count * h.stride;
+  u64 index_bytes = (u64)h.index_count * index_size(h.indices);
+  if (h.vertex_offset < sizeof(mesh_file_header) ||
+      h.vertex_offset > h.index_offset ||
+      vertex_bytes > h.index_offset - h.vertex_offset ||
+      h.index_offset > file_size || index_bytes > file_size - h.index_offset)
+    return false;
+
+  const vertex_attribute &position = h.attributes[0];
+  if (position.semantic != vertex_semantic::position ||
+      position.offset != 0 || position.components < 3)
+    return false;
+
+  for (u32 i = 0; i < h.attribute_count; ++i) {
+    const vertex_attribute &a = h.attributes[i];
+    if (a.components == 0 || a.components > 4 ||
+        a.offset + a.components * sizeof(f32) > h.stride)
+      return false;
+  }
+  return true;
+}
+
+template <typename T>
+static b8 indices_in_range(const T *indices, u32 count, u32 vertex_count) {
+  // a plain max reduction, which vectorizes
+  T max = 0;
+  for (u32 i = 0; i < count; ++i)
+    max = std::max(max, indices[i]);
+  return count == 0 || max < vertex_count;
+}
+
+static b8 validate_indices(const u8 *base, const mesh_file_header &h) {
+  const u8 *data = base + h.index_offset;
+  if (h.indices == index_format::u16)
+    return indices_in_range((const u16 *)data, h.index_count, h.vertex_count);
+  return indices_in_range((const u32 *)data, h.index_count, h.vertex_count);
+}
+
+#if defined(_WIN32)
+b8 mesh_file::open(const char *path, b8 verify_indices) {
+  close();
+
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) ||
+      (u64)file_size.QuadPart < sizeof(mesh_file_header)) {
+    CloseHandle(file);
+    return false;
+  }
+
+  // the mapping keeps the file open on its own
+  mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (!mapping)
+    return false;
+
+  base = (const u8 *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!base) {
+    CloseHandle(mapping);
+    mapping = nullptr;
+    return false;
+  }
+
+  mapped_size = (size)file_size.QuadPart;
+  header = (const mesh_file_header *)base;
+  if (!validate(*header, mapped_size) ||
+      (verify_indices && !validate_indices(base, *header))) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void mesh_file::close() {
+  if (base)
+    UnmapViewOfFile(base);
+  if (mapping)
+    CloseHandle(mapping);
+
+  base = nullptr;
+  header = nullptr;
+  mapping = nullptr;
+  mapped_size = 0;
+}
+#else
+b8 mesh_file::open(const char *path, b8 verify_indices) {
+  close();
+
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      (u64)info.st_size < sizeof(mesh_file_header)) {
+    ::close(fd);
+    return false;
+  }
+
+  // the mapping keeps the file open on its own
+  void *mapped = mmap(nullptr, (size)info.st_size, PROT_READ, MAP_PRIVATE, fd,
+                      0);
+  ::close(fd);
+  if (mapped == MAP_FAILED)
+    return false;
+
+  base = (const u8 *)mapped;
+  mapped_size = (size)info.st_size;
+  header = (const mesh_file_header *)base;
+  if (!validate(*header, mapped_size) ||
+      (verify_indices && !validate_indices(base, *header))) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void mesh_file::close() {
+  if (base)
+    munmap((void *)base, mapped_size);
+
+  base = nullptr;
+  header = nullptr;
+  mapped_size = 0;
+}
+#endif
+
+const vertex_attribute *
+mesh_file::find_attribute(vertex_semantic semantic) const {
+  for (u32 i = 0; i < header->attribute_count; ++i) {
+    if (header->attributes[i].semantic == semantic)
+      return &header->attributes[i];
+  }
+  return nullptr;
+}
+
+b8 write_mesh_file(const char *path, const mesh_data &mesh) {
+  if (mesh.attribute_count == 0 ||
+      mesh.attribute_count > max_vertex_attributes)
+    return false;
+  for (u32 i = 0; i < mesh.index_count; ++i) {
+    if (mesh.indices[i] >= mesh.vertex_count)
+      return false;
+  }
+
+  mesh_file_header h = {};
+  h.magic = mesh_file_magic;
+  h.version = mesh_file_version;
+  h.vertex_count = mesh.vertex_count;
+  h.index_count = mesh.index_count;
+  h.stride = mesh.stride;
+  h.attribute_count = mesh.attribute_count;
+  h.indices = mesh.vertex_count <= 0x10000 ? index_format::u16
+                                           : index_format::u32;
+  std::copy_n(mesh.attributes, mesh.attribute_count, h.attributes);
+
+  u64 vertex_bytes = (u64)mesh.vertex_count * mesh.stride;
+  u64 index_bytes = (u64)mesh.index_count * index_size(h.indices);
+  h.vertex_offset = align_up(sizeof(mesh_file_header), mesh_file_alignment);
+  h.index_offset =
+      align_up(h.vertex_offset + vertex_bytes, mesh_file_alignment);
+  h.file_size = h.index_offset + index_bytes;
+
+  h.bounds = compute_mesh_bounds(mesh.vertices, mesh.stride,
+                                 mesh.vertex_count,
+                                 mesh.attributes[0].offset);
+
+  if (!validate(h, h.file_size))
+    return false;
+
+  FILE *file = std::fopen(path, "wb");
+  if (!file)
+    return false;
+
+  static const u8 padding[mesh_file_alignment] = {};
+  std::fwrite(&h, sizeof(h), 1, file);
+  std::fwrite(padding, 1, h.vertex_offset - sizeof(h), file);
+  std::fwrite(mesh.vertices, 1, vertex_bytes, file);
+  std::fwrite(padding, 1, h.index_offset - h.vertex_offset - vertex_bytes,
+              file);
+
+  if (h.indices == index_format::u16) {
+    std::vector<u16> narrow(mesh.indices, mesh.indices + mesh.index_count);
+    std::fwrite(narrow.data(), sizeof(u16), narrow.size(), file);
+  } else {
+    std::fwrite(mesh.indices, sizeof(u32), mesh.index_count, file);
+  }
+
+  b8 ok = !std::ferror(file);
+  std::fclose(file);
+  return ok;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "bounds.hpp"
+#include "buffer.hpp"
+#include "types.hpp"
+
+// Binary mesh files: a fixed size header followed by the vertex and the
+// index data exactly as the pipeline reads them, so a mapped file is drawn
+// from without parsing or copying anything. Written by meshconv, see
+// src/meshconv.cpp.
+//
+// Layout, little endian:
+//   mesh_file_header
+//   vertices, vertex_count * stride bytes at vertex_offset
+//   indices, index_count u16 or u32 at index_offset
+// Both offsets are multiples of mesh_file_alignment.
+
+static constexpr u32 mesh_file_magic = 0x4853454d; // "MESH"
+static constexpr u32 mesh_file_version = 1;
+static constexpr u32 mesh_file_alignment = 64;
+static constexpr u32 max_vertex_attributes = 8;
+
+enum class vertex_semantic : u8 { position, normal, texcoord, color };
+
+// One attribute of the interleaved vertices, components f32s at offset bytes
+// into each vertex. The position is always first, at offset 0.
+struct vertex_attribute {
+  vertex_semantic semantic;
+  u8 components;
+  u16 offset;
+};
+
+struct mesh_file_header {
+  u32 magic;
+  u32 version;
+  u32 vertex_count;
+  u32 index_count;
+  u32 stride;
+  u32 attribute_count;
+  index_format indices;
+  u8 reserved[7];
+  u64 vertex_offset;
+  u64 index_offset;
+  u64 file_size;
+  mesh_bounds bounds; // model space
+  vertex_attribute attributes[max_vertex_attributes];
+};
+
+/// <summary>
+/// A mesh file mapped read only into memory. The vertex and index buffers
+/// point straight into the mapped pages and stay valid until the file is
+/// closed. Vertices are only paged in when a draw first touches them, the
+/// indices when open verifies them.
+/// </summary>
+struct mesh_file {
+  mesh_file() = default;
+  ~mesh_file() { close(); }
+
+  mesh_file(const mesh_file &) = delete;
+  mesh_file &operator=(const mesh_file &) = delete;
+
+  /// <summary>
+  /// Maps path and checks its header, false if it can't be opened or isn't
+  /// a valid mesh file of this version.
+  /// </summary>
+  /// <param name="verify_indices">Also checks every index against the
+  /// vertex count, which reads all index pages up front. Only pass false
+  /// for trusted files, an index out of range then faults in a
+  /// draw.</param>
+  b8 open(const char *path, b8 verify_indices = true);
+  void close();
+
+  inline b8 is_open() const { return header != nullptr; }
+
+  inline vertex_buffer get_vertices() const {
+    return vertex_buffer(base + header->vertex_offset, header->stride);
+  }
+
+  inline index_buffer get_indices() const {
+    const u8 *data = base + header->index_offset;
+    return header->indices == index_format::u16
+               ? index_buffer((const u16 *)data)
+               : index_buffer((const u32 *)data);
+  }
+
+  inline u32 get_vertex_count() const { return header->vertex_count; }
+  inline u32 get_index_count() const { return header->index_count; }
+  inline const mesh_bounds &get_bounds() const { return header->bounds; }
+
+  // The attribute with semantic, nullptr if the vertices have none.
+  const vertex_attribute *find_attribute(vertex_semantic semantic) const;
+
+private:
+  const u8 *base = nullptr;
+  const mesh_file_header *header = nullptr;
+  size mapped_size = 0;
+#if defined(_WIN32)
+  void *mapping = nullptr;
+#endif
+};
+
+// What write_mesh_file stores, the vertices interleaved as described by
+// attributes.
+struct mesh_data {
+  const void *vertices;
+  u32 vertex_count;
+  u32 stride;
+  const u32 *indices;
+  u32 index_count;
+  const vertex_attribute *attributes;
+  u32 attribute_count;
+};
+
+/// <summary>
+/// Writes mesh as a mesh file. The bounds are computed from the positions
+/// and the indices stored as u16 whenever every vertex can be addressed by
+/// one.
+/// </summary>
+b8 write_mesh_file(const char *path, const mesh_data &mesh);
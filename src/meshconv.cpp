@@ -0,0 +1,774 @@
+// Offline converter to the binary mesh format of mesh_file.hpp, so nothing
+// has to parse text at startup.
+//
+// usage: meshconv input.obj|input.gltf|input.glb output.mesh
+//
+// The vertices are interleaved as position, then normal and texcoord when
+// the input has them. All meshes and primitives of a glTF file end up in one
+// mesh, in model space: node transforms, sparse accessors and primitives
+// other than triangle lists are not supported.
+
+#include "mesh_file.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// What the loaders produce, vertices of floats_per_vertex floats laid out as
+// described by attributes.
+struct loaded_mesh {
+  std::vector<f32> vertices;
+  std::vector<u32> indices;
+  std::vector<vertex_attribute> attributes;
+  u32 floats_per_vertex = 0;
+};
+
+static b8 read_file(const char *path, std::string &out) {
+  FILE *file = std::fopen(path, "rb");
+  if (!file)
+    return false;
+
+  std::fseek(file, 0, SEEK_END);
+  long length = std::ftell(file);
+  std::fseek(file, 0, SEEK_SET);
+  if (length < 0) {
+    std::fclose(file);
+    return false;
+  }
+
+  out.resize((size)length);
+  b8 ok = std::fread(out.data(), 1, out.size(), file) == out.size();
+  std::fclose(file);
+  return ok;
+}
+
+// Position first, then the optional attributes, each in its own floats.
+static void set_layout(loaded_mesh &mesh, b8 normals, b8 texcoords) {
+  mesh.attributes = {{vertex_semantic::position, 3, 0}};
+  mesh.floats_per_vertex = 3;
+
+  if (normals) {
+    mesh.attributes.push_back(
+        {vertex_semantic::normal, 3, (u16)(mesh.floats_per_vertex * 4)});
+    mesh.floats_per_vertex += 3;
+  }
+  if (texcoords) {
+    mesh.attributes.push_back(
+        {vertex_semantic::texcoord, 2, (u16)(mesh.floats_per_vertex * 4)});
+    mesh.floats_per_vertex += 2;
+  }
+}
+
+namespace obj {
+struct corner {
+  i32 v, vt, vn;
+
+  b8 operator==(const corner &) const = default;
+};
+
+struct corner_hash {
+  size operator()(const corner &c) const {
+    return ((size)(u32)c.v * 73856093u) ^ ((size)(u32)c.vt * 19349663u) ^
+           ((size)(u32)c.vn * 83492791u);
+  }
+};
+
+static const char *skip_spaces(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t'))
+    ++p;
+  return p;
+}
+
+// Parses up to n floats from a line, missing ones stay 0.
+static void parse_floats(const char *p, const char *end, f32 *out, u32 n) {
+  for (u32 i = 0; i < n; ++i) {
+    p = skip_spaces(p, end);
+    out[i] = 0.f;
+    auto result = std::from_chars(p, end, out[i]);
+    p = result.ptr;
+  }
+}
+
+// An index of a face corner, 1 based or negative from the end of the list
+// so far. 0 when the corner leaves it out.
+static i32 resolve(i32 index, size count) {
+  if (index < 0)
+    return (i32)count + index + 1;
+  return index;
+}
+
+static b8 load(const char *path, loaded_mesh &mesh) {
+  std::string text;
+  if (!read_file(path, text))
+    return false;
+
+  std::vector<math::vec3> positions, normals;
+  std::vector<math::vec2> texcoords;
+  std::vector<corner> corners; // 3 per triangle
+
+  const char *p = text.data();
+  const char *text_end = p + text.size();
+  while (p < text_end) {
+    const char *end = (const char *)std::memchr(p, '\n', text_end - p);
+    if (!end)
+      end = text_end;
+    const char *line = skip_spaces(p, end);
+    p = end + 1;
+
+    if (end - line < 2)
+      continue;
+
+    if (line[0] == 'v' && line[1] == ' ') {
+      math::vec3 v;
+      parse_floats(line + 2, end, v.values, 3);
+      positions.push_back(v);
+    } else if (line[0] == 'v' && line[1] == 'n') {
+      math::vec3 n;
+      parse_floats(line + 2, end, n.values, 3);
+      normals.push_back(n);
+    } else if (line[0] == 'v' && line[1] == 't') {
+      math::vec2 t;
+      parse_floats(line + 2, end, t.values, 2);
+      texcoords.push_back(t);
+    } else if (line[0] == 'f' && line[1] == ' ') {
+      // v, v/vt, v//vn or v/vt/vn, polygons are fanned from their first
+      // corner
+      std::vector<corner> face;
+      const char *q = line + 2;
+      while ((q = skip_spaces(q, end)) < end && *q != '\r') {
+        i32 values[3] = {};
+        for (u32 k = 0; k < 3; ++k) {
+          auto result = std::from_chars(q, end, values[k]);
+          q = result.ptr;
+          if (q >= end || *q != '/')
+            break;
+          ++q;
+        }
+        while (q < end && *q != ' ' && *q != '\t')
+          ++q;
+
+        corner c = {resolve(values[0], positions.size()),
+                    resolve(values[1], texcoords.size()),
+                    resolve(values[2], normals.size())};
+        if (c.v <= 0 || c.v > (i32)positions.size() || c.vt < 0 ||
+            c.vt > (i32)texcoords.size() || c.vn < 0 ||
+            c.vn > (i32)normals.size()) {
+          std::fprintf(stderr, "%s: bad face index\n", path);
+          return false;
+        }
+        face.push_back(c);
+      }
+
+      for (size i = 2; i < face.size(); ++i) {
+        corners.push_back(face[0]);
+        corners.push_back(face[i - 1]);
+        corners.push_back(face[i]);
+      }
+    }
+  }
+
+  b8 has_normals = false, has_texcoords = false;
+  for (const corner &c : corners) {
+    has_normals |= c.vn > 0;
+    has_texcoords |= c.vt > 0;
+  }
+  set_layout(mesh, has_normals, has_texcoords);
+
+  // one vertex per distinct corner
+  std::unordered_map<corner, u32, corner_hash> vertex_of;
+  mesh.indices.reserve(corners.size());
+  for (const corner &c : corners) {
+    auto [it, inserted] =
+        vertex_of.try_emplace(c, (u32)vertex_of.size());
+    mesh.indices.push_back(it->second);
+    if (!inserted)
+      continue;
+
+    const math::vec3 &v = positions[c.v - 1];
+    mesh.vertices.insert(mesh.vertices.end(), {v.x, v.y, v.z});
+    if (has_normals) {
+      math::vec3 n = c.vn > 0 ? normals[c.vn - 1] : math::vec3{};
+      mesh.vertices.insert(mesh.vertices.end(), {n.x, n.y, n.z});
+    }
+    if (has_texcoords) {
+      math::vec2 t = c.vt > 0 ? texcoords[c.vt - 1] : math::vec2{};
+      mesh.vertices.insert(mesh.vertices.end(), {t.x, t.y});
+    }
+  }
+  return true;
+}
+} // namespace obj
+
+namespace gltf {
+// Just enough JSON for glTF: numbers are kept as f64, strings are not
+// unescaped beyond what the glTF names and URIs need.
+struct json {
+  enum class kind : u8 { null, boolean, number, string, array, object };
+
+  kind type = kind::null;
+  f64 number = 0.0;
+  std::string string;
+  std::vector<json> items;
+  std::vector<std::pair<std::string, json>> members;
+
+  const json *find(std::string_view key) const {
+    for (const auto &[name, value] : members) {
+      if (name == key)
+        return &value;
+    }
+    return nullptr;
+  }
+
+  const json *at(size i) const {
+    return type == kind::array && i < items.size() ? &items[i] : nullptr;
+  }
+
+  f64 get_number(std::string_view key, f64 fallback) const {
+    const json *v = find(key);
+    if (v && (v->type == kind::number || v->type == kind::boolean))
+      return v->number;
+    return fallback;
+  }
+};
+
+struct json_parser {
+  const char *p, *end;
+
+  void skip() {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+      ++p;
+  }
+
+  b8 parse_string(std::string &out) {
+    if (p >= end || *p != '"')
+      return false;
+    ++p;
+    while (p < end && *p != '"') {
+      if (*p == '\\' && p + 1 < end) {
+        ++p;
+        out.push_back(*p == 'n' ? '\n' : *p == 't' ? '\t' : *p);
+      } else {
+        out.push_back(*p);
+      }
+      ++p;
+    }
+    if (p >= end)
+      return false;
+    ++p;
+    return true;
+  }
+
+  b8 parse(json &out) {
+    skip();
+    if (p >= end)
+      return false;
+
+    if (*p == '{') {
+      out.type = json::kind::object;
+      ++p;
+      skip();
+      if (p < end && *p == '}') {
+        ++p;
+        return true;
+      }
+      for (;;) {
+        skip();
+        std::string key;
+        if (!parse_string(key))
+          return false;
+        skip();
+        if (p >= end || *p != ':')
+          return false;
+        ++p;
+        out.members.emplace_back(std::move(key), json{});
+        if (!parse(out.members.back().second))
+          return false;
+        skip();
+        if (p < end && *p == ',') {
+          ++p;
+          continue;
+        }
+        if (p < end && *p == '}') {
+          ++p;
+          return true;
+        }
+        return false;
+      }
+    }
+
+    if (*p == '[') {
+      out.type = json::kind::array;
+      ++p;
+      skip();
+      if (p < end && *p == ']') {
+        ++p;
+        return true;
+      }
+      for (;;) {
+        out.items.emplace_back();
+        if (!parse(out.items.back()))
+          return false;
+        skip();
+        if (p < end && *p == ',') {
+          ++p;
+          continue;
+        }
+        if (p < end && *p == ']') {
+          ++p;
+          return true;
+        }
+        return false;
+      }
+    }
+
+    if (*p == '"') {
+      out.type = json::kind::string;
+      return parse_string(out.string);
+    }
+
+    auto keyword = [&](std::string_view word) {
+      if ((size)(end - p) < word.size() ||
+          std::string_view(p, word.size()) != word)
+        return false;
+      p += word.size();
+      return true;
+    };
+    if (keyword("true") || keyword("false")) {
+      out.type = json::kind::boolean;
+      out.number = p[-2] == 'u'; // true
+      return true;
+    }
+    if (keyword("null"))
+      return true;
+
+    out.type = json::kind::number;
+    auto result = std::from_chars(p, end, out.number);
+    if (result.ec != std::errc())
+      return false;
+    p = result.ptr;
+    return true;
+  }
+};
+
+static b8 decode_base64(std::string_view in, std::string &out) {
+  auto value = [](char c) -> i32 {
+    if (c >= 'A' && c <= 'Z')
+      return c - 'A';
+    if (c >= 'a' && c <= 'z')
+      return c - 'a' + 26;
+    if (c >= '0' && c <= '9')
+      return c - '0' + 52;
+    if (c == '+')
+      return 62;
+    if (c == '/')
+      return 63;
+    return -1;
+  };
+
+  u32 bits = 0, count = 0;
+  for (char c : in) {
+    if (c == '=')
+      break;
+    i32 v = value(c);
+    if (v < 0)
+      return false;
+    bits = (bits << 6) | (u32)v;
+    count += 6;
+    if (count >= 8) {
+      count -= 8;
+      out.push_back((char)((bits >> count) & 0xff));
+    }
+  }
+  return true;
+}
+
+struct document {
+  json root;
+  std::vector<std::string> buffers;
+};
+
+// Reads the buffers of a .gltf, external files next to it or data URIs.
+// The buffer of a .glb without uri is its BIN chunk.
+static b8 load_buffers(const char *path, document &doc,
+                       std::string *glb_bin) {
+  const json *buffers = doc.root.find("buffers");
+  if (!buffers)
+    return true;
+
+  std::string dir = path;
+  size slash = dir.find_last_of("/\\");
+  dir = slash == std::string::npos ? std::string() : dir.substr(0, slash + 1);
+
+  for (const json &buffer : buffers->items) {
+    doc.buffers.emplace_back();
+    const json *uri = buffer.find("uri");
+    if (!uri) {
+      if (!glb_bin)
+        return false;
+      doc.buffers.back() = std::move(*glb_bin);
+      continue;
+    }
+
+    std::string_view u = uri->string;
+    if (u.starts_with("data:")) {
+      size comma = u.find(',');
+      if (comma == std::string_view::npos ||
+          !decode_base64(u.substr(comma + 1), doc.buffers.back()))
+        return false;
+    } else if (!read_file((dir + uri->string).c_str(), doc.buffers.back())) {
+      std::fprintf(stderr, "%s: can't read buffer %s\n", path,
+                   uri->string.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+static b8 load_document(const char *path, document &doc) {
+  std::string file;
+  if (!read_file(path, file))
+    return false;
+
+  std::string_view json_text = file;
+  std::string bin;
+  b8 glb = file.size() >= 12 && std::memcmp(file.data(), "glTF", 4) == 0;
+
+  if (glb) {
+    // 12 byte header, then chunks of length, type and data
+    json_text = {};
+    for (size at = 12; at + 8 <= file.size();) {
+      u32 length, type;
+      std::memcpy(&length, file.data() + at, 4);
+      std::memcpy(&type, file.data() + at + 4, 4);
+      if (at + 8 + length > file.size())
+        return false;
+
+      std::string_view chunk(file.data() + at + 8, length);
+      if (type == 0x4e4f534a) // JSON
+        json_text = chunk;
+      else if (type == 0x004e4942) // BIN
+        bin = chunk;
+      at += 8 + ((length + 3) & ~3u);
+    }
+  }
+
+  json_parser parser = {json_text.data(),
+                        json_text.data() + json_text.size()};
+  if (!parser.parse(doc.root) || doc.root.type != json::kind::object) {
+    std::fprintf(stderr, "%s: invalid JSON\n", path);
+    return false;
+  }
+  return load_buffers(path, doc, glb ? &bin : nullptr);
+}
+
+static u32 component_count(const std::string &type) {
+  if (type == "SCALAR")
+    return 1;
+  if (type == "VEC2")
+    return 2;
+  if (type == "VEC3")
+    return 3;
+  if (type == "VEC4")
+    return 4;
+  return 0;
+}
+
+static u32 component_size(u32 component_type) {
+  switch (component_type) {
+  case 5120: // byte
+  case 5121: // unsigned byte
+    return 1;
+  case 5122: // short
+  case 5123: // unsigned short
+    return 2;
+  case 5125: // unsigned int
+  case 5126: // float
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+// One component as a float, normalized integers mapped to [0, 1] or
+// [-1, 1].
+static f32 read_component(const u8 *p, u32 component_type, b8 normalized) {
+  switch (component_type) {
+  case 5120: {
+    i8 v = (i8)*p;
+    return normalized ? std::max(v / 127.f, -1.f) : v;
+  }
+  case 5121:
+    return normalized ? *p / 255.f : *p;
+  case 5122: {
+    i16 v;
+    std::memcpy(&v, p, 2);
+    return normalized ? std::max(v / 32767.f, -1.f) : v;
+  }
+  case 5123: {
+    u16 v;
+    std::memcpy(&v, p, 2);
+    return normalized ? v / 65535.f : v;
+  }
+  case 5125: {
+    u32 v;
+    std::memcpy(&v, p, 4);
+    return (f32)v;
+  }
+  default: {
+    f32 v;
+    std::memcpy(&v, p, 4);
+    return v;
+  }
+  }
+}
+
+// The elements of an accessor, resolved through its buffer view.
+struct accessor_data {
+  const u8 *data;
+  u32 count;
+  u32 components;
+  u32 component_type;
+  size stride;
+  b8 normalized;
+};
+
+static b8 find_accessor(const document &doc, u32 index, accessor_data &out) {
+  const json *accessors = doc.root.find("accessors");
+  const json *views = doc.root.find("bufferViews");
+  const json *accessor = accessors ? accessors->at(index) : nullptr;
+  if (!accessor || !views || accessor->find("sparse"))
+    return false;
+
+  i64 view_index = (i64)accessor->get_number("bufferView", -1);
+  const json *view = views->at((size)view_index);
+  const json *type = accessor->find("type");
+  if (!view || !type)
+    return false;
+
+  out.component_type = (u32)accessor->get_number("componentType", 0);
+  out.count = (u32)accessor->get_number("count", 0);
+  out.components = component_count(type->string);
+  out.normalized = accessor->get_number("normalized", 0.0) != 0.0;
+
+  u32 element_size = out.components * component_size(out.component_type);
+  size buffer = (size)(i64)view->get_number("buffer", -1);
+  if (buffer >= doc.buffers.size() || element_size == 0)
+    return false;
+
+  out.stride = (size)view->get_number("byteStride", element_size);
+  size offset = (size)view->get_number("byteOffset", 0) +
+                (size)accessor->get_number("byteOffset", 0);
+  const std::string &data = doc.buffers[buffer];
+  if (out.count &&
+      offset + (out.count - 1) * out.stride + element_size > data.size())
+    return false;
+
+  out.data = (const u8 *)data.data() + offset;
+  return true;
+}
+
+// Reads accessor index as floats, components per element. Elements with
+// fewer components are padded with 0.
+static b8 read_floats(const document &doc, u32 index, u32 components,
+                      std::vector<f32> &out) {
+  accessor_data a;
+  if (!find_accessor(doc, index, a))
+    return false;
+
+  u32 c_size = component_size(a.component_type);
+  out.assign((size)a.count * components, 0.f);
+  for (u32 i = 0; i < a.count; ++i) {
+    const u8 *element = a.data + i * a.stride;
+    for (u32 k = 0; k < std::min(a.components, components); ++k) {
+      out[(size)i * components + k] = read_component(
+          element + k * c_size, a.component_type, a.normalized);
+    }
+  }
+  return true;
+}
+
+static b8 read_indices(const document &doc, u32 index,
+                       std::vector<u32> &out) {
+  accessor_data a;
+  if (!find_accessor(doc, index, a) || a.components != 1)
+    return false;
+
+  out.resize(a.count);
+  for (u32 i = 0; i < a.count; ++i) {
+    const u8 *element = a.data + i * a.stride;
+    if (a.component_type == 5121) {
+      out[i] = *element;
+    } else if (a.component_type == 5123) {
+      u16 v;
+      std::memcpy(&v, element, sizeof(v));
+      out[i] = v;
+    } else if (a.component_type == 5125) {
+      std::memcpy(&out[i], element, sizeof(u32));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+static b8 load(const char *path, loaded_mesh &mesh) {
+  document doc;
+  if (!load_document(path, doc))
+    return false;
+
+  const json *meshes = doc.root.find("meshes");
+  if (!meshes) {
+    std::fprintf(stderr, "%s: no meshes\n", path);
+    return false;
+  }
+
+  // the layout has to be known before the first vertex is written
+  b8 has_normals = false, has_texcoords = false;
+  for (const json &m : meshes->items) {
+    if (const json *primitives = m.find("primitives")) {
+      for (const json &prim : primitives->items) {
+        const json *attributes = prim.find("attributes");
+        has_normals |= attributes && attributes->find("NORMAL");
+        has_texcoords |= attributes && attributes->find("TEXCOORD_0");
+      }
+    }
+  }
+  set_layout(mesh, has_normals, has_texcoords);
+
+  std::vector<f32> positions, normals, texcoords;
+  std::vector<u32> indices;
+  for (const json &m : meshes->items) {
+    const json *primitives = m.find("primitives");
+    if (!primitives)
+      continue;
+
+    for (const json &prim : primitives->items) {
+      if (prim.get_number("mode", 4) != 4) {
+        std::fprintf(stderr, "%s: skipping a non triangle primitive\n", path);
+        continue;
+      }
+
+      const json *attributes = prim.find("attributes");
+      const json *position = attributes ? attributes->find("POSITION")
+                                        : nullptr;
+      if (!position ||
+          !read_floats(doc, (u32)position->number, 3, positions)) {
+        std::fprintf(stderr, "%s: bad POSITION accessor\n", path);
+        return false;
+      }
+
+      size count = positions.size() / 3;
+      normals.assign(count * 3, 0.f);
+      texcoords.assign(count * 2, 0.f);
+      const json *normal = attributes->find("NORMAL");
+      const json *texcoord = attributes->find("TEXCOORD_0");
+      if ((normal && !read_floats(doc, (u32)normal->number, 3, normals)) ||
+          (texcoord &&
+           !read_floats(doc, (u32)texcoord->number, 2, texcoords)) ||
+          normals.size() != count * 3 || texcoords.size() != count * 2) {
+        std::fprintf(stderr, "%s: bad vertex accessor\n", path);
+        return false;
+      }
+
+      u32 base = (u32)(mesh.vertices.size() / mesh.floats_per_vertex);
+      for (size i = 0; i < count; ++i) {
+        mesh.vertices.insert(mesh.vertices.end(), &positions[i * 3],
+                             &positions[i * 3] + 3);
+        if (has_normals) {
+          mesh.vertices.insert(mesh.vertices.end(), &normals[i * 3],
+                               &normals[i * 3] + 3);
+        }
+        if (has_texcoords) {
+          mesh.vertices.insert(mesh.vertices.end(), &texcoords[i * 2],
+                               &texcoords[i * 2] + 2);
+        }
+      }
+
+      if (const json *index = prim.find("indices")) {
+        if (!read_indices(doc, (u32)index->number, indices)) {
+          std::fprintf(stderr, "%s: bad index accessor\n", path);
+          return false;
+        }
+        for (u32 i : indices)
+          mesh.indices.push_back(base + i);
+      } else {
+        for (u32 i = 0; i < (u32)count; ++i)
+          mesh.indices.push_back(base + i);
+      }
+    }
+  }
+  return true;
+}
+} // namespace gltf
+
+static b8 ends_with(std::string_view s, std::string_view suffix) {
+  if (s.size() < suffix.size())
+    return false;
+  for (size i = 0; i < suffix.size(); ++i) {
+    char c = s[s.size() - suffix.size() + i];
+    if (std::tolower((unsigned char)c) != suffix[i])
+      return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    std::fprintf(stderr,
+                 "usage: meshconv input.obj|input.gltf|input.glb "
+                 "output.mesh\n");
+    return 1;
+  }
+
+  const char *in_path = argv[1];
+  const char *out_path = argv[2];
+
+  loaded_mesh mesh;
+  b8 loaded = false;
+  if (ends_with(in_path, ".obj")) {
+    loaded = obj::load(in_path, mesh);
+  } else if (ends_with(in_path, ".gltf") || ends_with(in_path, ".glb")) {
+    loaded = gltf::load(in_path, mesh);
+  } else {
+    std::fprintf(stderr, "%s: unknown format\n", in_path);
+    return 1;
+  }
+
+  if (!loaded) {
+    std::fprintf(stderr, "failed to load %s\n", in_path);
+    return 1;
+  }
+
+  u32 vertex_count = (u32)(mesh.vertices.size() / mesh.floats_per_vertex);
+  mesh_data data = {mesh.vertices.data(),
+                    vertex_count,
+                    mesh.floats_per_vertex * (u32)sizeof(f32),
+                    mesh.indices.data(),
+                    (u32)mesh.indices.size(),
+                    mesh.attributes.data(),
+                    (u32)mesh.attributes.size()};
+  if (!write_mesh_file(out_path, data)) {
+    std::fprintf(stderr, "failed to write %s\n", out_path);
+    return 1;
+  }
+
+  mesh_file written;
+  if (!written.open(out_path)) {
+    std::fprintf(stderr, "%s does not read back\n", out_path);
+    return 1;
+  }
+
+  const aabb &box = written.get_bounds().box;
+  std::printf("%s: %u vertices, %u triangles, %u bytes per vertex\n",
+              out_path, written.get_vertex_count(),
+              written.get_index_count() / 3, data.stride);
+  std::printf("  bounds (%g, %g, %g) - (%g, %g, %g)\n", box.min.x, box.min.y,
+              box.min.z, box.max.x, box.max.y, box.max.z);
+  return 0;
+}
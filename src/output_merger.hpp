@@ -0,0 +1,171 @@
+#pragma once
+
+#include "color.hpp"
+#include "pipeline_state.hpp"
+#include "types.hpp"
+#include "vector.hpp"
+#include <bit>
+#include <immintrin.h>
+
+// Output merger: combines shaded colors with the render target. Colors are
+// RGBA8 throughout, blending is done in 16 bit fixed point, 4 pixels per
+// instruction.
+
+// Converts 4 shader colors to RGBA8, the same clamp and truncation as
+// to_color.
+static inline __m128i pack_colors(const math::vec4 src[4]) {
+  const __m128 scale = _mm_set1_ps(255.f);
+  const __m128 zero = _mm_setzero_ps();
+
+  __m128i c[4];
+  for (u32 i = 0; i < 4; ++i) {
+    __m128 v = _mm_mul_ps(_mm_loadu_ps(src[i].values), scale);
+    c[i] = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(v, zero), scale));
+  }
+  return _mm_packus_epi16(_mm_packs_epi32(c[0], c[1]),
+                          _mm_packs_epi32(c[2], c[3]));
+}
+
+static inline color pack_color(const math::vec4 &src) {
+  const __m128 scale = _mm_set1_ps(255.f);
+  __m128 v = _mm_mul_ps(_mm_loadu_ps(src.values), scale);
+  __m128i c = _mm_cvttps_epi32(
+      _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), scale));
+  c = _mm_packus_epi16(_mm_packs_epi32(c, c), c);
+
+  color out;
+  _mm_storeu_si32(&out, c);
+  return out;
+}
+
+// Byte mask of the channels set in color_write, as they lie in a color.
+static inline u32 color_write_bytes(u8 color_write) {
+  u32 bytes = 0;
+  for (u32 i = 0; i < 4; ++i) {
+    if (color_write & (1u << i))
+      bytes |= 0xffu << (i * 8);
+  }
+  return bytes;
+}
+
+namespace merger_detail {
+// t / 255 rounded, for t up to 255 * 255 in every 16 bit lane
+static inline __m128i div255(__m128i t) {
+  t = _mm_add_epi16(t, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// source alpha of both pixels in a register of two unpacked pixels
+static inline __m128i splat_alpha(__m128i c) {
+  c = _mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 3, 3));
+  return _mm_shufflehi_epi16(c, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+// a * b / 255 for two unpacked pixels
+static inline __m128i mul255(__m128i a, __m128i b) {
+  return div255(_mm_mullo_epi16(a, b));
+}
+
+// Blend equation of Blend for 4 pixels.
+template <blend_mode Blend>
+static inline __m128i blend4(__m128i src, __m128i dst) {
+  if constexpr (Blend == blend_mode::opaque) {
+    return src;
+  } else {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi16(255);
+    __m128i s_lo = _mm_unpacklo_epi8(src, zero);
+    __m128i s_hi = _mm_unpackhi_epi8(src, zero);
+    __m128i d_lo = _mm_unpacklo_epi8(dst, zero);
+    __m128i d_hi = _mm_unpackhi_epi8(dst, zero);
+    __m128i a_lo = splat_alpha(s_lo);
+    __m128i a_hi = splat_alpha(s_hi);
+
+    if constexpr (Blend == blend_mode::alpha) {
+      // (src * a + dst * (255 - a)) / 255, the sum can't exceed 255 * 255
+      __m128i lo =
+          _mm_add_epi16(_mm_mullo_epi16(s_lo, a_lo),
+                        _mm_mullo_epi16(d_lo, _mm_sub_epi16(max, a_lo)));
+      __m128i hi =
+          _mm_add_epi16(_mm_mullo_epi16(s_hi, a_hi),
+                        _mm_mullo_epi16(d_hi, _mm_sub_epi16(max, a_hi)));
+      return _mm_packus_epi16(div255(lo), div255(hi));
+    } else if constexpr (Blend == blend_mode::additive) {
+      __m128i add =
+          _mm_packus_epi16(mul255(s_lo, a_lo), mul255(s_hi, a_hi));
+      return _mm_adds_epu8(dst, add);
+    } else {
+      static_assert(Blend == blend_mode::premultiplied);
+      __m128i keep =
+          _mm_packus_epi16(mul255(d_lo, _mm_sub_epi16(max, a_lo)),
+                           mul255(d_hi, _mm_sub_epi16(max, a_hi)));
+      return _mm_adds_epu8(src, keep);
+    }
+  }
+}
+
+// Blends and writes the pixels of lanes, keeping the channels outside of
+// write_bytes (see color_write_bytes) and the pixels outside of lanes.
+template <blend_mode Blend>
+static inline __m128i merge4(__m128i src, __m128i dst, u32 lanes,
+                             u32 write_bytes) {
+  // byte mask of the lanes, one u32 per pixel
+  __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+  __m128i keep = _mm_cmpeq_epi32(
+      _mm_and_si128(_mm_set1_epi32((i32)lanes), lane_bits), lane_bits);
+  keep = _mm_and_si128(keep, _mm_set1_epi32((i32)write_bytes));
+
+  __m128i out = blend4<Blend>(src, dst);
+  return _mm_or_si128(_mm_and_si128(keep, out), _mm_andnot_si128(keep, dst));
+}
+} // namespace merger_detail
+
+// Merges up to 32 pixels of src into dst, the pixels set in lanes. dst
+// is only touched up to the highest lane, so a span can end at the edge of
+// the render target.
+typedef void (*merge_span_fn)(color *dst, const color *src, u32 lanes,
+                              u32 write_bytes);
+
+template <blend_mode Blend>
+static void merge_span(color *dst, const color *src, u32 lanes,
+                       u32 write_bytes) {
+  u32 count = (u32)std::bit_width(lanes);
+
+  u32 i = 0;
+  for (; i + 4 <= count; i += 4) {
+    u32 group = (lanes >> i) & 0xf;
+    if (!group)
+      continue;
+
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    _mm_storeu_si128(
+        (__m128i *)(dst + i),
+        merger_detail::merge4<Blend>(s, d, group, write_bytes));
+  }
+
+  for (; i < count; ++i) {
+    if (!(lanes & (1u << i)))
+      continue;
+
+    __m128i s = _mm_loadu_si32(src + i);
+    __m128i d = _mm_loadu_si32(dst + i);
+    _mm_storeu_si32(dst + i,
+                    merger_detail::merge4<Blend>(s, d, 1, write_bytes));
+  }
+}
+
+// The merge_span of a blend mode, picked once per draw.
+static inline merge_span_fn select_output_merger(blend_mode blend) {
+  switch (blend) {
+  case blend_mode::alpha:
+    return merge_span<blend_mode::alpha>;
+  case blend_mode::additive:
+    return merge_span<blend_mode::additive>;
+  case blend_mode::premultiplied:
+    return merge_span<blend_mode::premultiplied>;
+  case blend_mode::opaque:
+  default:
+    return merge_span<blend_mode::opaque>;
+  }
+}
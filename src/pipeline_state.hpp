@@ -0,0 +1,35 @@
+#pragma once
+
+#include "depth.hpp"
+#include "types.hpp"
+
+enum class blend_mode : u8 {
+  opaque,        // src overwrites dst
+  alpha,         // src * src.a + dst * (1 - src.a)
+  additive,      // src * src.a + dst, saturated
+  premultiplied, // src + dst * (1 - src.a), saturated, src is premultiplied
+};
+
+// Bits of pipeline_state::color_write, channels that are not set keep their
+// value in the render target.
+enum color_write_bits : u8 {
+  color_write_r = 1,
+  color_write_g = 2,
+  color_write_b = 4,
+  color_write_a = 8,
+  color_write_all = 15,
+};
+
+// Winding is on screen, counter-clockwise triangles are front facing.
+enum class cull_mode : u8 { none, back, front };
+
+// All fixed function state of a draw. The raster kernel for a draw is picked
+// from it once, so none of it is branched on per pixel. The defaults draw
+// every triangle over what is there, depth testing and culling are opted
+// into.
+struct pipeline_state {
+  depth_state depth;
+  blend_mode blend = blend_mode::opaque;
+  u8 color_write = color_write_all;
+  cull_mode cull = cull_mode::none;
+};
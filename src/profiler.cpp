@@ -0,0 +1,106 @@
+#include "profiler.hpp"
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace profiler {
+namespace {
+struct zone_event {
+  const char *name;
+  u64 begin_ns, end_ns;
+};
+
+struct counter_event {
+  const char *name;
+  u64 time_ns;
+  f64 value;
+};
+
+// Zones are recorded into a buffer per thread so recording never locks.
+// Buffers are owned by the registry and outlive their threads.
+struct thread_events {
+  u32 tid;
+  std::vector<zone_event> zones;
+};
+
+// per thread cap, further zones are dropped
+constexpr size max_zones_per_thread = size(1) << 22;
+
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<thread_events>> registry;
+std::vector<counter_event> counters;
+const u64 start_ns = now_ns();
+
+thread_events &local_events() {
+  thread_local thread_events *events = nullptr;
+
+  if (!events) {
+    std::lock_guard lock(registry_mutex);
+    registry.push_back(std::make_unique<thread_events>());
+    events = registry.back().get();
+    events->tid = (u32)registry.size() - 1;
+  }
+
+  return *events;
+}
+} // namespace
+
+void record_zone(const char *name, u64 begin_ns, u64 end_ns) {
+  thread_events &events = local_events();
+  if (events.zones.size() < max_zones_per_thread)
+    events.zones.push_back({name, begin_ns, end_ns});
+}
+
+void record_counter(const char *name, f64 value) {
+  std::lock_guard lock(registry_mutex);
+  counters.push_back({name, now_ns(), value});
+}
+
+void clear() {
+  std::lock_guard lock(registry_mutex);
+  for (std::unique_ptr<thread_events> &events : registry)
+    events->zones.clear();
+  counters.clear();
+}
+
+b8 write_chrome_trace(const char *path) {
+  FILE *file = std::fopen(path, "w");
+  if (!file)
+    return false;
+
+  std::lock_guard lock(registry_mutex);
+
+  // timestamps are in microseconds
+  auto us = [](u64 ns) { return (f64)(ns - start_ns) / 1000.0; };
+
+  std::fprintf(file, "{\"traceEvents\":[\n");
+  b8 first = true;
+
+  for (const std::unique_ptr<thread_events> &events : registry) {
+    for (const zone_event &zone : events->zones) {
+      std::fprintf(file,
+                   "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+                   "\"dur\":%.3f,\"pid\":0,\"tid\":%u}",
+                   first ? "" : ",\n", zone.name, us(zone.begin_ns),
+                   (f64)(zone.end_ns - zone.begin_ns) / 1000.0, events->tid);
+      first = false;
+    }
+  }
+
+  for (const counter_event &counter : counters) {
+    std::fprintf(file,
+                 "%s{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":0,"
+                 "\"args\":{\"value\":%.17g}}",
+                 first ? "" : ",\n", counter.name, us(counter.time_ns),
+                 counter.value);
+    first = false;
+  }
+
+  std::fprintf(file, "\n]}\n");
+
+  b8 ok = !std::ferror(file);
+  std::fclose(file);
+  return ok;
+}
+} // namespace profiler
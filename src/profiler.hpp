@@ -0,0 +1,59 @@
+#pragma once
+
+#include "types.hpp"
+#include <chrono>
+
+// Profiling zones, counters and the raster statistics are only compiled in
+// when RASTER_PROFILE is defined (cmake -DRASTER_PROFILING=ON). Otherwise the
+// macros below expand to nothing.
+#if defined(RASTER_PROFILE)
+static constexpr b8 profiling_enabled = true;
+#else
+static constexpr b8 profiling_enabled = false;
+#endif
+
+namespace profiler {
+inline u64 now_ns() {
+  return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// name must outlive the profiler, string literals are what is expected
+void record_zone(const char *name, u64 begin_ns, u64 end_ns);
+void record_counter(const char *name, f64 value);
+
+// Drops everything recorded so far. Like write_chrome_trace it must not run
+// while other threads are recording, call it between frames.
+void clear();
+
+/// <summary>
+/// Writes all zones and counters as Chrome trace event JSON, loadable in
+/// chrome://tracing or Perfetto.
+/// </summary>
+b8 write_chrome_trace(const char *path);
+
+struct scoped_zone {
+  scoped_zone(const char *name) : name(name), begin_ns(now_ns()) {}
+  ~scoped_zone() { record_zone(name, begin_ns, now_ns()); }
+
+  scoped_zone(const scoped_zone &) = delete;
+  scoped_zone &operator=(const scoped_zone &) = delete;
+
+private:
+  const char *name;
+  u64 begin_ns;
+};
+} // namespace profiler
+
+#if defined(RASTER_PROFILE)
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name)                                                     \
+  profiler::scoped_zone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_COUNTER(name, value)                                           \
+  profiler::record_counter(name, (f64)(value))
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_COUNTER(name, value) ((void)0)
+#endif
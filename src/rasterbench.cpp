@@ -0,0 +1,320 @@
+// Headless benchmark: renders a fixed, animated scene into an offscreen
+// framebuffer and reports frame timings. Needs no display or SDL.
+//
+// usage: rasterbench [--frames n] [--width w] [--height h] [--threads n]
+//                    [--grid n] [--out image.png|image.ppm]
+//                    [--trace trace.json] [--tiled] [--msaa]
+//                    [--mesh file.mesh]
+//
+// --trace needs a build with RASTER_PROFILING, otherwise the trace is empty.
+// --mesh spins a mesh file made by meshconv instead of drawing the grid.
+
+#include "framebuffer.hpp"
+#include "image_io.hpp"
+#include "mesh_file.hpp"
+#include "profiler.hpp"
+#include "renderer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+struct bench_options {
+  u32 frames = 300;
+  u32 width = 800;
+  u32 height = 600;
+  u32 threads = std::thread::hardware_concurrency();
+  u32 grid = 32;
+  const char *out_path = nullptr;
+  const char *trace_path = nullptr;
+  const char *mesh_path = nullptr;
+  b8 tiled = false;
+  b8 msaa = false;
+};
+
+struct grid_vertex {
+  math::vec2 offset; // from the center of its quad
+  math::vec2 center;
+  math::vec4 col;
+};
+
+// Spins every quad of the grid around its own center.
+struct grid_shader {
+  f32 cos_t, sin_t;
+
+  size varying_size() const { return sizeof(math::vec4); }
+
+  void vertex_shader(const void *in, math::vec4 *out_pos,
+                     void *out_var) const {
+    const grid_vertex *v = (const grid_vertex *)in;
+
+    f32 x = v->offset.x * cos_t - v->offset.y * sin_t;
+    f32 y = v->offset.x * sin_t + v->offset.y * cos_t;
+
+    *out_pos = math::vec4{v->center.x + x, v->center.y + y, 0.f, 1.f};
+    std::memcpy(out_var, &v->col, sizeof(math::vec4));
+  }
+
+  math::vec4 fragment_shader(void *in_var) const {
+    return *(const math::vec4 *)in_var;
+  }
+};
+
+// Colors a mesh file by its view space normals, or by depth when it has
+// none.
+struct mesh_shader {
+  math::mat4 mvp;
+  math::mat4 normal_matrix; // inverse transpose of the model view matrix
+  i32 normal_offset;        // -1 without normals
+
+  size varying_size() const { return sizeof(math::vec4); }
+
+  void vertex_shader(const void *in, math::vec4 *out_pos,
+                     void *out_var) const {
+    const u8 *v = (const u8 *)in;
+    *out_pos = mvp * math::vec4{*(const math::vec3 *)v, 1.f};
+
+    math::vec4 col = {0.5f, 0.5f, 0.5f, 1.f};
+    if (normal_offset >= 0) {
+      const math::vec3 &n = *(const math::vec3 *)(v + normal_offset);
+      math::vec4 view_n = normal_matrix * math::vec4{n, 0.f};
+      col = math::vec4{view_n.x * 0.5f + 0.5f, view_n.y * 0.5f + 0.5f,
+                       view_n.z * 0.5f + 0.5f, 1.f};
+    } else if (out_pos->w > 0.f) {
+      f32 depth = out_pos->z / out_pos->w * -0.5f + 0.5f;
+      col = math::vec4{depth, depth, depth, 1.f};
+    }
+    std::memcpy(out_var, &col, sizeof(math::vec4));
+  }
+
+  math::vec4 fragment_shader(void *in_var) const {
+    return *(const math::vec4 *)in_var;
+  }
+};
+
+// Model view projection that keeps the bounds of a mesh in view while it
+// spins around its center, and the matrix its normals are transformed by.
+static void mesh_transform(const mesh_bounds &bounds, f32 t, mesh_shader &out) {
+  f32 radius = std::max(bounds.sphere.radius, 1e-3f);
+  f32 distance = radius * 3.f;
+
+  math::mat4 model = math::mat4::rotation_y(t) *
+                     math::mat4::translate(bounds.sphere.center * -1.f);
+  math::mat4 view =
+      math::mat4::translate(math::vec3{0.f, 0.f, -distance});
+  math::mat4 proj = math::mat4::perspective(distance - radius,
+                                            distance + radius, 0.7f, 1.f);
+
+  math::mat4 model_view = view * model;
+  out.mvp = proj * model_view;
+  out.normal_matrix = math::transpose(math::inverse(model_view));
+}
+
+static void build_grid(u32 n, std::vector<grid_vertex> &vertices,
+                       std::vector<u32> &indices) {
+  f32 cell = 2.f / n;
+  f32 half = cell * 0.45f;
+
+  for (u32 gy = 0; gy < n; ++gy) {
+    for (u32 gx = 0; gx < n; ++gx) {
+      math::vec2 center = {-1.f + cell * (gx + 0.5f),
+                           -1.f + cell * (gy + 0.5f)};
+      math::vec4 col = {(f32)gx / n, (f32)gy / n, 1.f - (f32)gx / n, 1.f};
+      u32 base = (u32)vertices.size();
+
+      vertices.push_back({{-half, -half}, center, col});
+      vertices.push_back({{half, -half}, center, col});
+      vertices.push_back({{-half, half}, center, col});
+      vertices.push_back({{half, half}, center, col});
+
+      for (u32 i : {0u, 1u, 2u, 1u, 3u, 2u})
+        indices.push_back(base + i);
+    }
+  }
+}
+
+static b8 parse_options(int argc, char *argv[], bench_options &opts) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+    auto number = [&](u32 &out) {
+      if (!value)
+        return false;
+      out = (u32)std::strtoul(value, nullptr, 10);
+      ++i;
+      return true;
+    };
+
+    b8 ok = false;
+    if (!std::strcmp(arg, "--frames"))
+      ok = number(opts.frames);
+    else if (!std::strcmp(arg, "--width"))
+      ok = number(opts.width);
+    else if (!std::strcmp(arg, "--height"))
+      ok = number(opts.height);
+    else if (!std::strcmp(arg, "--threads"))
+      ok = number(opts.threads);
+    else if (!std::strcmp(arg, "--grid"))
+      ok = number(opts.grid);
+    else if (!std::strcmp(arg, "--out") && value) {
+      opts.out_path = value;
+      ++i;
+      ok = true;
+    } else if (!std::strcmp(arg, "--tiled")) {
+      opts.tiled = true;
+      ok = true;
+    } else if (!std::strcmp(arg, "--msaa")) {
+      opts.msaa = true;
+      ok = true;
+    } else if (!std::strcmp(arg, "--mesh") && value) {
+      opts.mesh_path = value;
+      ++i;
+      ok = true;
+    } else if (!std::strcmp(arg, "--trace") && value) {
+      opts.trace_path = value;
+      ++i;
+      ok = true;
+    }
+
+    if (!ok) {
+      std::fprintf(stderr, "unknown or incomplete option %s\n", arg);
+      return false;
+    }
+  }
+
+  return opts.frames > 0 && opts.width > 0 && opts.height > 0 &&
+         opts.grid > 0;
+}
+
+int main(int argc, char *argv[]) {
+  bench_options opts;
+  if (!parse_options(argc, argv, opts)) {
+    std::fprintf(stderr,
+                 "usage: rasterbench [--frames n] [--width w] [--height h] "
+                 "[--threads n] [--grid n] [--out image.png|image.ppm] "
+                 "[--trace trace.json] [--tiled] [--msaa] "
+                 "[--mesh file.mesh]\n");
+    return 1;
+  }
+
+  framebuffer fb(opts.width, opts.height,
+                 opts.tiled ? framebuffer_layout::tiled
+                            : framebuffer_layout::linear,
+                 opts.msaa ? msaa_samples : 1);
+  rendering_pipeline pipeline(fb, opts.threads);
+
+  pipeline_state state;
+  state.depth.test_enable = true;
+  state.depth.write_enable = true;
+  state.cull = cull_mode::back;
+  pipeline.set_pipeline_state(state);
+
+  std::vector<grid_vertex> vertices;
+  std::vector<u32> indices;
+  build_grid(opts.grid, vertices, indices);
+
+  vertex_buffer vbuf(vertices.data(), sizeof(grid_vertex));
+  index_buffer ibuf(indices.data());
+  size triangles = indices.size() / 3;
+
+  mesh_file mesh;
+  i32 normal_offset = -1;
+  if (opts.mesh_path) {
+    auto start = std::chrono::steady_clock::now();
+    if (!mesh.open(opts.mesh_path)) {
+      std::fprintf(stderr, "failed to open %s\n", opts.mesh_path);
+      return 1;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    const vertex_attribute *normal =
+        mesh.find_attribute(vertex_semantic::normal);
+    if (normal)
+      normal_offset = normal->offset;
+    triangles = mesh.get_index_count() / 3;
+    std::printf("rasterbench: %s mapped in %.3f ms\n", opts.mesh_path,
+                std::chrono::duration<f64, std::milli>(end - start).count());
+  }
+
+  std::vector<f64> frame_ms(opts.frames);
+
+  for (u32 frame = 0; frame < opts.frames; ++frame) {
+    // fixed time step so every run renders the same frames
+    f32 t = frame / 60.f;
+    grid_shader shader = {std::cos(t), std::sin(t)};
+
+    auto start = std::chrono::steady_clock::now();
+    PROFILE_ZONE("frame");
+
+    fb.clear_color(colors::black);
+    fb.clear_depth(1.f);
+    if (mesh.is_open()) {
+      mesh_shader spin;
+      spin.normal_offset = normal_offset;
+      mesh_transform(mesh.get_bounds(), t, spin);
+      pipeline.draw_indexed(spin, mesh.get_vertices(), mesh.get_indices(),
+                            (i32)mesh.get_index_count());
+    } else {
+      pipeline.draw_indexed(shader, vbuf, ibuf, (i32)indices.size());
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    frame_ms[frame] =
+        std::chrono::duration<f64, std::milli>(end - start).count();
+  }
+
+  std::vector<f64> sorted = frame_ms;
+  std::sort(sorted.begin(), sorted.end());
+
+  f64 total = 0.0;
+  for (f64 ms : frame_ms)
+    total += ms;
+
+  f64 mean = total / opts.frames;
+  std::printf("rasterbench: %ux%u %s%s, %u threads, %zu triangles, "
+              "%u frames\n",
+              opts.width, opts.height, opts.tiled ? "tiled" : "linear",
+              opts.msaa ? " 4x msaa" : "", opts.threads, triangles,
+              opts.frames);
+  std::printf("  mean %.3f ms  median %.3f ms  min %.3f ms  max %.3f ms\n",
+              mean, sorted[sorted.size() / 2], sorted.front(), sorted.back());
+  std::printf("  %.1f frames/s\n", 1000.0 / mean);
+
+  if constexpr (profiling_enabled) {
+    pipeline_stats stats = pipeline.get_pipeline_stats();
+    std::printf("  per frame: %.0f vertices shaded, %.0f primitives culled, "
+                "%.0f pixels tested, %.0f depth rejects, %.0f fragments "
+                "shaded\n",
+                (f64)stats.vertices_shaded / opts.frames,
+                (f64)stats.primitives_culled / opts.frames,
+                (f64)stats.pixels_tested / opts.frames,
+                (f64)stats.depth_rejects / opts.frames,
+                (f64)stats.fragments_shaded / opts.frames);
+  }
+
+  if (opts.trace_path) {
+    if (!profiler::write_chrome_trace(opts.trace_path)) {
+      std::fprintf(stderr, "failed to write %s\n", opts.trace_path);
+      return 1;
+    }
+    std::printf("  trace written to %s\n", opts.trace_path);
+  }
+
+  if (opts.out_path) {
+    std::vector<color> pixels((size)opts.width * opts.height);
+    fb.read_color(pixels.data());
+
+    if (!image_io::write_image(opts.out_path, pixels.data(), opts.width,
+                               opts.height)) {
+      std::fprintf(stderr, "failed to write %s\n", opts.out_path);
+      return 1;
+    }
+    std::printf("  last frame written to %s\n", opts.out_path);
+  }
+
+  return 0;
+}
@@ -0,0 +1,901 @@
+#pragma once
+
+#include "cull.hpp"
+#include "depth.hpp"
+#include "framebuffer.hpp"
+#include "output_merger.hpp"
+#include "pipeline_state.hpp"
+#include "profiler.hpp"
+#include "shader_program.hpp"
+#include "texture.hpp"
+#include "types.hpp"
+#include "varying.hpp"
+#include "vector.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <immintrin.h>
+
+// half-open pixel rectangle [xmin, xmax) x [ymin, ymax)
+struct rect {
+  i32 xmin, ymin, xmax, ymax;
+};
+
+// The screen is split into tile_size x tile_size tiles. Triangles are binned
+// into every tile they touch and each tile is rasterized by exactly one worker,
+// so the color and depth buffers can be written without any locking.
+static constexpr i32 tile_size = 64;
+
+// Vertices are snapped to 1/256th of a pixel (16.8 fixed point) before the
+// edge functions are set up, so coverage is exact integer math.
+static constexpr i32 subpixel_bits = 8;
+static constexpr i32 subpixel_scale = 1 << subpixel_bits;
+
+// Largest screen space coordinate (in pixels) the fixed point setup accepts.
+static constexpr f32 max_raster_coord = 8192.f;
+
+// Sample positions of multisampled framebuffers, the standard rotated grid,
+// in 1/16th pixel from the pixel center.
+static constexpr i32 sample_offsets[msaa_samples][2] = {
+    {-2, -6}, {6, -2}, {-6, 2}, {2, 6}};
+
+// farthest a sample lies from its pixel center along x or y, in 1/16th pixel
+static constexpr i32 sample_reach = 6;
+
+// Coverage is computed for raster_block x raster_block pixel blocks at a
+// time. A block_mask has bit (y * raster_block + x) set for covered pixels.
+static constexpr i32 raster_block = 8;
+using block_mask = u64;
+
+static_assert(raster_block == hiz_block_size,
+              "raster blocks map 1:1 onto hierarchical z blocks");
+
+// Blocks of coarse_block x coarse_block pixels are classified against the
+// triangle before any raster_block inside of them is looked at.
+static constexpr i32 coarse_block = 16;
+
+// Edge function sampled at pixel centers: a * x + b * y + c. A pixel is on
+// the inside of the edge when the value is >= 0, the top-left fill rule is
+// already folded into c.
+struct edge_fn {
+  i64 a, b, c;
+
+  inline i64 eval(i32 x, i32 y) const { return a * x + b * y + c; }
+};
+
+struct triangle_setup {
+  // edges[i] is the edge opposite of vertex i, so its value scaled by
+  // inv_area is the barycentric weight of vertex i
+  edge_fn edges[3];
+  f64 inv_area;
+
+  // low subpixel bits floored out of each edge c, see sample_edge
+  i32 edge_frac[3];
+
+  // sample_reach for multisampled targets, else 0: how far coverage can
+  // reach past the pixel centers
+  i32 reach;
+
+  // Planes are evaluated relative to this pixel, the top left of the
+  // bounds, so c stays small and f32 keeps its precision across the screen.
+  i32 origin_x, origin_y;
+
+  // window space depth and its range over the triangle
+  plane_eq z;
+  f32 zmin, zmax;
+
+  // 1 / w, divides the interpolated varying planes
+  plane_eq w;
+
+  // pixels whose centers can be covered by the triangle
+  rect bounds;
+};
+
+// Plane through the values v0, v1, v2 at the vertices of tri, that is
+// sum(v_i * edge_i * inv_area), moved to the plane origin of tri. Done in
+// double since the edge c can be large.
+static inline plane_eq make_plane(const triangle_setup &tri, f64 v0, f64 v1,
+                                  f64 v2) {
+  f64 a = 0.0, b = 0.0, c = 0.0;
+  const f64 v[3] = {v0, v1, v2};
+  for (i32 i = 0; i < 3; ++i) {
+    const edge_fn &e = tri.edges[i];
+    a += v[i] * (f64)e.a;
+    b += v[i] * (f64)e.b;
+    c += v[i] * (f64)e.eval(tri.origin_x, tri.origin_y);
+  }
+  return plane_eq{(f32)(a * tri.inv_area), (f32)(b * tri.inv_area),
+                  (f32)(c * tri.inv_area)};
+}
+
+// Edge i of tri at sample s instead of the pixel center. The bits floored
+// out of c are put back before the offset is applied, so it stays exact.
+static inline edge_fn sample_edge(const triangle_setup &tri, i32 i, u32 s) {
+  constexpr i64 unit = subpixel_scale / 16;
+  const edge_fn &e = tri.edges[i];
+  i64 offset = tri.edge_frac[i] + unit * (e.a * sample_offsets[s][0] +
+                                          e.b * sample_offsets[s][1]);
+  return edge_fn{e.a, e.b, e.c + (offset >> subpixel_bits)};
+}
+
+// Triangles whose bounds are at most this many pixels across on their
+// shorter axis get their coverage tested one row (or column) at a time, so
+// thin slivers and sub-pixel triangles that miss every sample are culled
+// before they are binned. Wider triangles are never tested, a long diagonal
+// sliver between the samples still reaches the raster stage.
+static constexpr i32 thin_triangle_span = 4;
+
+static inline i64 floor_div(i64 n, i64 d) {
+  return n >= 0 ? n / d : -((d - 1 - n) / d);
+}
+
+// Whether any integer x in [x0, x1) is inside all three edges on row y,
+// from the x range each edge leaves instead of evaluating every x.
+static inline b8 span_covered(const edge_fn e[3], i32 y, i64 x0, i64 x1) {
+  for (i32 i = 0; i < 3; ++i) {
+    // inside when a * x >= -v
+    i64 v = e[i].b * y + e[i].c;
+    if (e[i].a > 0)
+      x0 = std::max(x0, -floor_div(v, e[i].a));
+    else if (e[i].a < 0)
+      x1 = std::min(x1, floor_div(v, -e[i].a) + 1);
+    else if (v < 0)
+      return false;
+  }
+  return x0 < x1;
+}
+
+/// <summary>
+/// Culling stage and setup in one: snaps the screen space positions to fixed
+/// point, rejects the triangle as early as possible and otherwise computes
+/// its edge functions, depth plane and pixel bounds.
+/// </summary>
+/// <param name="sample_count">Samples per pixel of the render target</param>
+/// <returns>cull_result::visible, or why the triangle was culled</returns>
+static inline cull_result setup_triangle(const math::vec4 positions[3],
+                                         cull_mode cull, triangle_setup &out,
+                                         u32 sample_count = 1) {
+  i64 X[3], Y[3];
+  for (i32 i = 0; i < 3; ++i) {
+    // also rejects NaNs
+    if (!(std::fabs(positions[i].x) <= max_raster_coord &&
+          std::fabs(positions[i].y) <= max_raster_coord))
+      return cull_result::invalid;
+
+    X[i] = (i64)std::lrint(positions[i].x * subpixel_scale);
+    Y[i] = (i64)std::lrint(positions[i].y * subpixel_scale);
+  }
+
+  i64 area2 = (X[1] - X[0]) * (Y[2] - Y[0]) - (Y[1] - Y[0]) * (X[2] - X[0]);
+
+  if (area2 == 0)
+    return cull_result::degenerate;
+
+  // counter-clockwise on screen (negative area) is front facing
+  b8 back_facing = area2 > 0;
+  if ((cull == cull_mode::back && back_facing) ||
+      (cull == cull_mode::front && !back_facing))
+    return cull_result::facing;
+
+  constexpr i64 half = subpixel_scale / 2;
+
+  i64 xmin = std::min({X[0], X[1], X[2]});
+  i64 xmax = std::max({X[0], X[1], X[2]});
+  i64 ymin = std::min({Y[0], Y[1], Y[2]});
+  i64 ymax = std::max({Y[0], Y[1], Y[2]});
+
+  // first and last pixel with a sample that can lie inside [min, max]
+  out.reach = sample_count > 1 ? sample_reach : 0;
+  i64 reach = out.reach * (subpixel_scale / 16);
+  out.bounds = rect{(i32)-((half + reach - xmin) >> subpixel_bits),
+                    (i32)-((half + reach - ymin) >> subpixel_bits),
+                    (i32)((xmax - half + reach) >> subpixel_bits) + 1,
+                    (i32)((ymax - half + reach) >> subpixel_bits) + 1};
+
+  const rect &bounds = out.bounds;
+  if (bounds.xmin >= bounds.xmax || bounds.ymin >= bounds.ymax)
+    return cull_result::no_samples;
+
+  // Back faces are walked with vertex 1 and 2 swapped so the inside of every
+  // edge is positive, edges stay indexed by the original vertex.
+  const i32 order[3] = {0, back_facing ? 2 : 1, back_facing ? 1 : 2};
+  i64 abs_area2 = back_facing ? area2 : -area2;
+
+  for (i32 k = 0; k < 3; ++k) {
+    i32 i = order[k];
+    i32 a = order[(k + 1) % 3];
+    i32 b = order[(k + 2) % 3];
+
+    i64 dx = X[b] - X[a];
+    i64 dy = Y[b] - Y[a];
+
+    // top edges are horizontal and run right to left, left edges run down
+    b8 top_left = dy > 0 || (dy == 0 && dx < 0);
+
+    // value at the center of pixel (0, 0); samples exactly on a non top-left
+    // edge are pushed outside by the bias
+    i64 c = dy * (half - X[a]) - dx * (half - Y[a]) + (top_left ? 0 : -1);
+
+    // Stepping one pixel changes the value by a multiple of subpixel_scale,
+    // so the low bits only matter for the sign and can be floored away
+    // (>> on a signed value rounds towards negative infinity).
+    out.edges[i] = edge_fn{dy, -dx, c >> subpixel_bits};
+    out.edge_frac[i] = (i32)(c & (subpixel_scale - 1));
+  }
+
+  i32 width = bounds.xmax - bounds.xmin;
+  i32 height = bounds.ymax - bounds.ymin;
+  if (std::min(width, height) <= thin_triangle_span) {
+    // walk the shorter axis, with x and y swapped for tall triangles
+    b8 columns = height > width;
+    i32 row_min = columns ? bounds.xmin : bounds.ymin;
+    i32 row_max = columns ? bounds.xmax : bounds.ymax;
+    i32 span_min = columns ? bounds.ymin : bounds.xmin;
+    i32 span_max = columns ? bounds.ymax : bounds.xmax;
+
+    b8 covered = false;
+    for (u32 s = 0; s < sample_count && !covered; ++s) {
+      edge_fn e[3] = {out.edges[0], out.edges[1], out.edges[2]};
+      for (i32 i = 0; i < 3; ++i) {
+        if (sample_count > 1)
+          e[i] = sample_edge(out, i, s);
+        if (columns)
+          std::swap(e[i].a, e[i].b);
+      }
+
+      for (i32 r = row_min; r < row_max && !covered; ++r)
+        covered = span_covered(e, r, span_min, span_max);
+    }
+
+    if (!covered)
+      return cull_result::no_samples;
+  }
+
+  out.inv_area = (f64)subpixel_scale / (f64)abs_area2;
+  out.origin_x = bounds.xmin;
+  out.origin_y = bounds.ymin;
+
+  out.z = make_plane(out, positions[0].z, positions[1].z, positions[2].z);
+  out.w = make_plane(out, positions[0].w, positions[1].w, positions[2].w);
+  out.zmin = std::min({positions[0].z, positions[1].z, positions[2].z});
+  out.zmax = std::max({positions[0].z, positions[1].z, positions[2].z});
+
+  return cull_result::visible;
+}
+
+/// <summary>
+/// Builds the varying planes of a triangle that passed setup_triangle, in the
+/// layout interpolate_planes reads.
+/// </summary>
+/// <param name="positions">The positions given to setup_triangle, 1 / w in
+/// w</param>
+/// <param name="vars">Varyings of the three vertices</param>
+/// <param name="planes">Receives 3 * plane_floats(floats) floats</param>
+static inline void setup_varying_planes(const triangle_setup &tri,
+                                        const math::vec4 positions[3],
+                                        const f32 *const vars[3], u32 floats,
+                                        f32 *planes) {
+  u32 stride = plane_floats(floats);
+
+  for (u32 i = 0; i < stride; ++i) {
+    plane_eq p = {};
+    if (i < floats) {
+      p = make_plane(tri, (f64)vars[0][i] * positions[0].w,
+                     (f64)vars[1][i] * positions[1].w,
+                     (f64)vars[2][i] * positions[2].w);
+    }
+
+    planes[i] = p.a;
+    planes[stride + i] = p.b;
+    planes[2 * stride + i] = p.c;
+  }
+}
+
+enum class block_class { outside, partial, inside };
+
+// Trivial accept/reject for square blocks of one size. Adding reject[i] to
+// the value of edge i at the block origin gives its largest value inside the
+// block, adding accept[i] gives its smallest one. Both are widened by how
+// far the samples reach past the pixel centers.
+struct block_classifier {
+  block_classifier(const triangle_setup &tri, i32 block_size) : tri(tri) {
+    i64 extent = block_size - 1;
+    for (i32 i = 0; i < 3; ++i) {
+      const edge_fn &edge = tri.edges[i];
+      i64 spread = (std::abs(edge.a) + std::abs(edge.b)) * tri.reach *
+                   (subpixel_scale / 16);
+      i64 margin = (spread + subpixel_scale - 1) >> subpixel_bits;
+
+      reject[i] =
+          extent * (std::max<i64>(edge.a, 0) + std::max<i64>(edge.b, 0)) +
+          margin;
+      accept[i] =
+          extent * (std::min<i64>(edge.a, 0) + std::min<i64>(edge.b, 0)) -
+          margin;
+    }
+  }
+
+  block_class classify(i32 bx, i32 by) const {
+    b8 inside = true;
+    for (i32 i = 0; i < 3; ++i) {
+      i64 e = tri.edges[i].eval(bx, by);
+      if (e + reject[i] < 0)
+        return block_class::outside;
+
+      inside = inside && e + accept[i] >= 0;
+    }
+    return inside ? block_class::inside : block_class::partial;
+  }
+
+private:
+  const triangle_setup &tri;
+  i64 reject[3];
+  i64 accept[3];
+};
+
+// Edge values at a block origin are clamped to this before the per lane math
+// runs in 32 bits. With coordinates limited to max_raster_coord the steps
+// across one block are far smaller, so clamping never flips a lane's sign.
+static constexpr i64 lane_clamp = i64(1) << 30;
+
+/// <summary>
+/// Evaluates all three edge functions for the raster_block x raster_block
+/// block at (bx, by), 8 (AVX2) or 4 (SSE) pixels per instruction.
+/// </summary>
+/// <param name="edges">The triangle's edges, or their sample_edge</param>
+/// <param name="col_mask">Columns of the block inside the bounds</param>
+/// <param name="row_begin">First row inside the bounds</param>
+/// <param name="row_end">One past the last row inside the bounds</param>
+/// <returns>The coverage mask of the block</returns>
+static inline block_mask block_coverage(const edge_fn edges[3], i32 bx,
+                                        i32 by, u32 col_mask, i32 row_begin,
+                                        i32 row_end) {
+  i32 e[3], a[3], b[3];
+  for (i32 i = 0; i < 3; ++i) {
+    const edge_fn &edge = edges[i];
+    e[i] = (i32)std::clamp(edge.eval(bx, by + row_begin), -lane_clamp,
+                           lane_clamp);
+    a[i] = (i32)edge.a;
+    b[i] = (i32)edge.b;
+  }
+
+  block_mask mask = 0;
+
+#if defined(__AVX2__)
+  __m256i row[3], step[3];
+  for (i32 i = 0; i < 3; ++i) {
+    row[i] = _mm256_add_epi32(
+        _mm256_set1_epi32(e[i]),
+        _mm256_setr_epi32(0, a[i], 2 * a[i], 3 * a[i], 4 * a[i], 5 * a[i],
+                          6 * a[i], 7 * a[i]));
+    step[i] = _mm256_set1_epi32(b[i]);
+  }
+
+  for (i32 y = row_begin; y < row_end; ++y) {
+    // a lane is outside as soon as one of the edge values is negative
+    __m256i any = _mm256_or_si256(_mm256_or_si256(row[0], row[1]), row[2]);
+    u32 outside = (u32)_mm256_movemask_ps(_mm256_castsi256_ps(any));
+    mask |= (block_mask)(~outside & col_mask) << (y * raster_block);
+
+    for (i32 i = 0; i < 3; ++i)
+      row[i] = _mm256_add_epi32(row[i], step[i]);
+  }
+#elif defined(__SSE2__)
+  __m128i lo[3], hi[3], step[3];
+  for (i32 i = 0; i < 3; ++i) {
+    lo[i] = _mm_add_epi32(_mm_set1_epi32(e[i]),
+                          _mm_setr_epi32(0, a[i], 2 * a[i], 3 * a[i]));
+    hi[i] = _mm_add_epi32(lo[i], _mm_set1_epi32(4 * a[i]));
+    step[i] = _mm_set1_epi32(b[i]);
+  }
+
+  for (i32 y = row_begin; y < row_end; ++y) {
+    __m128i any_lo = _mm_or_si128(_mm_or_si128(lo[0], lo[1]), lo[2]);
+    __m128i any_hi = _mm_or_si128(_mm_or_si128(hi[0], hi[1]), hi[2]);
+    u32 outside = (u32)_mm_movemask_ps(_mm_castsi128_ps(any_lo)) |
+                  ((u32)_mm_movemask_ps(_mm_castsi128_ps(any_hi)) << 4);
+    mask |= (block_mask)(~outside & col_mask) << (y * raster_block);
+
+    for (i32 i = 0; i < 3; ++i) {
+      lo[i] = _mm_add_epi32(lo[i], step[i]);
+      hi[i] = _mm_add_epi32(hi[i], step[i]);
+    }
+  }
+#else
+  for (i32 y = row_begin; y < row_end; ++y) {
+    i32 w0 = e[0], w1 = e[1], w2 = e[2];
+    for (i32 x = 0; x < raster_block; ++x) {
+      if ((w0 | w1 | w2) >= 0 && (col_mask & (1u << x)))
+        mask |= (block_mask)1 << (y * raster_block + x);
+
+      w0 += a[0];
+      w1 += a[1];
+      w2 += a[2];
+    }
+
+    for (i32 i = 0; i < 3; ++i)
+      e[i] += b[i];
+  }
+#endif
+
+  return mask;
+}
+
+// mask of the pixels of a block that lie inside the clipped bounds
+static inline block_mask bounds_mask(u32 col_mask, i32 row_begin,
+                                     i32 row_end) {
+  block_mask mask = 0;
+  for (i32 y = row_begin; y < row_end; ++y)
+    mask |= (block_mask)col_mask << (y * raster_block);
+  return mask;
+}
+
+// Per worker raster counters, only updated when profiling_enabled.
+struct raster_stats {
+  u64 pixels_tested;    // covered pixels that reached the depth test
+  u64 depth_rejects;    // of those, failed it (per pixel or by hi-z)
+  u64 fragments_shaded; // fragment shader invocations, helper lanes aside
+};
+
+// Everything a raster kernel needs that is the same for all triangles of a
+// draw and tile.
+struct raster_context {
+  framebuffer *fb;
+  const void *shader; // points to the Shader the kernel was instantiated for
+  u32 varying_floats;
+  raster_stats *stats; // of the worker running the kernel
+  const texture_binding *textures; // handed to quad shaders
+
+  // output merger of kernels built with Merge, see select_output_merger
+  merge_span_fn merge;
+  u32 write_bytes; // color_write_bytes of the pipeline state
+
+  // depth state that is not compiled into the kernel, see depth_kernel
+  compare_func depth_func;
+  b8 depth_write;
+};
+
+// Depth test a raster kernel is built for. off also covers
+// compare_func::always, the common less tests are compiled in and the
+// others are read from raster_context::depth_func.
+enum class depth_kernel : u8 { off, less, less_equal, other };
+
+// The pipeline state a raster kernel is specialized for, only what takes
+// work out of the inner loops. Merge kernels read the render target back
+// through the output merger, the others only store (opaque with all
+// channels written). Samples is the sample count of the render target.
+// Depth writes and the varying count are runtime state.
+template <depth_kernel Depth, b8 Merge, u32 Samples> struct raster_config {
+  static constexpr depth_kernel depth = Depth;
+  static constexpr b8 merge = Merge;
+  static constexpr u32 samples = Samples;
+};
+
+typedef void (*raster_kernel_fn)(const raster_context &ctx,
+                                 const triangle_setup &tri,
+                                 const f32 *planes, // setup_varying_planes
+                                 const rect &clip);
+
+template <typename Shader, typename Config>
+static void draw_triangle(const raster_context &ctx, const triangle_setup &tri,
+                          const f32 *planes, // setup_varying_planes
+                          const rect &clip) {
+  i32 xmin = std::max(tri.bounds.xmin, clip.xmin);
+  i32 ymin = std::max(tri.bounds.ymin, clip.ymin);
+  i32 xmax = std::min(tri.bounds.xmax, clip.xmax);
+  i32 ymax = std::min(tri.bounds.ymax, clip.ymax);
+
+  if (xmin >= xmax || ymin >= ymax)
+    return;
+
+  constexpr depth_kernel depth = Config::depth;
+  constexpr b8 depth_test = depth != depth_kernel::off;
+  constexpr b8 multisample = Config::samples > 1;
+
+  // compiled in compare of the less kernels
+  constexpr compare_func fixed_func = depth == depth_kernel::less
+                                          ? compare_func::less
+                                      : depth == depth_kernel::less_equal
+                                          ? compare_func::less_equal
+                                          : compare_func::always;
+
+  framebuffer &fb = *ctx.fb;
+  const Shader &shader = *(const Shader *)ctx.shader;
+  u32 varying_floats = ctx.varying_floats;
+  compare_func depth_func =
+      depth == depth_kernel::other ? ctx.depth_func : fixed_func;
+  u32 depth_bits = depth_compare_bits(depth_func);
+
+  auto depth_passes = [&](f32 z, f32 stored) {
+    if constexpr (depth == depth_kernel::other)
+      return depth_compare_bits_pass(depth_bits, z, stored);
+    else
+      return depth_compare(fixed_func, z, stored);
+  };
+
+  // Multisampling: coverage and depth are per sample, the fragment shader
+  // still runs once per pixel and its color goes to every live sample.
+  // sample_live holds those samples (as a mask) for each pixel of the block
+  // being shaded.
+  edge_fn sample_edges[Config::samples][3];
+  f32 sample_dz[Config::samples];
+  u8 sample_live[multisample ? raster_block * raster_block : 1];
+  if constexpr (multisample) {
+    for (u32 s = 0; s < Config::samples; ++s) {
+      for (i32 i = 0; i < 3; ++i)
+        sample_edges[s][i] = sample_edge(tri, i, s);
+      sample_dz[s] = (tri.z.a * sample_offsets[s][0] +
+                      tri.z.b * sample_offsets[s][1]) /
+                     16.f;
+    }
+  }
+
+  // Merge kernels collect the colors of a block and hand them to the output
+  // merger one block row at a time, see merge_block.
+  alignas(16) color block_colors[Config::merge ? raster_block * raster_block
+                                               : 1];
+
+  // bit is the pixel's bit in the block mask
+  auto write_color = [&](i32 x, i32 y, i32 bit, const color &c) {
+    if constexpr (Config::merge)
+      block_colors[bit] = c;
+    else if constexpr (multisample)
+      fb.put_samples(x, y, sample_live[bit], c);
+    else
+      fb.put_pixel(x, y, c);
+  };
+
+  // Merges the samples of one block row of a multisampled target in a
+  // single call. The live samples are packed into consecutive lanes, a
+  // compressed pixel with every sample covered takes only one, so the 8
+  // pixels of a row never need more than the 32 lanes of the merger.
+  auto merge_samples = [&](i32 x0, i32 y, i32 row, u32 pixels) {
+    alignas(16) color dst[raster_block * msaa_samples];
+    alignas(16) color src[raster_block * msaa_samples];
+    const color *colors = block_colors + row * raster_block;
+    const u8 *live = sample_live + row * raster_block;
+
+    u32 whole = 0;
+    u32 n = 0;
+    for (u32 m = pixels; m; m &= m - 1) {
+      u32 p = (u32)std::countr_zero(m);
+      u32 x = (u32)x0 + p;
+      if (live[p] == msaa_full_mask && fb.pixel_compressed(x, y)) {
+        whole |= 1u << p;
+        dst[n] = fb.get_sample(x, y, 0);
+        src[n++] = colors[p];
+        continue;
+      }
+
+      for (u32 ms = live[p]; ms; ms &= ms - 1) {
+        dst[n] = fb.get_sample(x, y, (u32)std::countr_zero(ms));
+        src[n++] = colors[p];
+      }
+    }
+
+    ctx.merge(dst, src, n == 32 ? ~0u : (1u << n) - 1, ctx.write_bytes);
+
+    n = 0;
+    for (u32 m = pixels; m; m &= m - 1) {
+      u32 p = (u32)std::countr_zero(m);
+      u32 x = (u32)x0 + p;
+      if (whole & (1u << p)) {
+        fb.put_samples(x, y, msaa_full_mask, dst[n++]);
+      } else {
+        fb.put_sample_colors(x, y, live[p], dst + n);
+        n += (u32)std::popcount(live[p]);
+      }
+    }
+  };
+
+  // Merges the colors written into block_colors for the pixels of mask.
+  // The rows of a block lie within one tile, so each is contiguous.
+  auto merge_block = [&](i32 bx, i32 by, block_mask mask) {
+    for (i32 row = 0; row < raster_block && mask; ++row) {
+      u32 lanes = (u32)(mask >> (row * raster_block)) & 0xff;
+      if (!lanes)
+        continue;
+
+      if constexpr (multisample) {
+        merge_samples(bx, by + row, row, lanes);
+      } else {
+        ctx.merge(fb.pixel_row(bx, by + row), block_colors + row * raster_block,
+                  lanes, ctx.write_bytes);
+      }
+    }
+  };
+
+  static_assert(raster_block == 8, "merge_block takes 8 bit rows");
+  static_assert(raster_block * msaa_samples <= 32,
+                "a multisampled block row fits the lanes of one merge");
+
+  // Varyings handed to the shader, only the one its entry point reads is
+  // sized. Zeroed since the planes only fill plane_floats(varying_floats)
+  // of them, which the compiler can't tell is all a shader reads.
+  constexpr u32 max_floats = max_varying_size / sizeof(f32);
+  f32 interp_buffer[quad_shader<Shader> ? 1 : max_floats] = {};
+  alignas(16) f32 quad_vars[quad_shader<Shader> ? max_floats * quad_lanes
+                                                : 1] = {};
+
+  // Runs the quad shader on every 2x2 quad of the block with at least one
+  // live pixel. Helper lanes are interpolated as well (the planes extrapolate
+  // past the edges) so derivatives stay valid.
+  auto shade_quads = [&](i32 bx, i32 by, block_mask mask) {
+    for (i32 qy = 0; qy < raster_block; qy += 2) {
+      for (i32 qx = 0; qx < raster_block; qx += 2) {
+        u32 top = (u32)(mask >> (qy * raster_block + qx)) & 3;
+        u32 bottom = (u32)(mask >> ((qy + 1) * raster_block + qx)) & 3;
+        u32 lanes = top | (bottom << 2);
+        if (!lanes)
+          continue;
+
+        interpolate_planes_quad(
+            planes, varying_floats, tri.w, (f32)(bx + qx - tri.origin_x),
+            (f32)(by + qy - tri.origin_y), quad_vars);
+
+        math::vec4 colors[quad_lanes];
+        if constexpr (quad_shader<Shader>)
+          shader.fragment_shader_quad(
+              fragment_quad{lanes, quad_vars, ctx.textures}, colors);
+
+        alignas(16) color packed[quad_lanes];
+        _mm_store_si128((__m128i *)packed, pack_colors(colors));
+
+        for (u32 m = lanes; m; m &= m - 1) {
+          u32 lane = (u32)std::countr_zero(m);
+          i32 x = qx + (i32)(lane & 1);
+          i32 y = qy + (i32)(lane >> 1);
+          write_color(bx + x, by + y, y * raster_block + x, packed[lane]);
+        }
+      }
+    }
+  };
+
+  // Depth tests (when test_pixels) and writes the pixels of mask, the
+  // samples in sample_live when multisampling. Write is a template argument
+  // so the branch on it stays out of the loop.
+  auto test_depth = [&]<b8 Write>(i32 bx, i32 by, block_mask mask,
+                                  b8 test_pixels) {
+    block_mask live = 0;
+    for (block_mask m = mask; m; m &= m - 1) {
+      i32 bit = std::countr_zero(m);
+      i32 x = bx + (bit % raster_block);
+      i32 y = by + (bit / raster_block);
+
+      f32 z = tri.z.eval((f32)(x - tri.origin_x), (f32)(y - tri.origin_y));
+
+      if constexpr (multisample) {
+        u32 passed = 0;
+        for (u32 m = sample_live[bit]; m; m &= m - 1) {
+          u32 s = (u32)std::countr_zero(m);
+          f32 zs = z + sample_dz[s];
+          if (depth_test && test_pixels &&
+              !depth_passes(zs, fb.get_depth(x, y, s)))
+            continue;
+
+          if constexpr (Write)
+            fb.put_depth(x, y, zs, s);
+
+          passed |= 1u << s;
+        }
+
+        sample_live[bit] = (u8)passed;
+        if (!passed)
+          continue;
+      } else {
+        if (depth_test && test_pixels && !depth_passes(z, fb.get_depth(x, y)))
+          continue;
+
+        if constexpr (Write)
+          fb.put_depth(x, y, z);
+      }
+
+      live |= (block_mask)1 << bit;
+    }
+    return live;
+  };
+
+  // Early z: the fragment shader can't change depth, so fragments are
+  // tested (and depth is written) before it runs. When multisampling, mask
+  // has the pixels with any sample covered and sample_masks the coverage of
+  // each sample.
+  auto shade_block = [&](i32 bx, i32 by, block_mask mask,
+                         const block_mask *sample_masks) {
+    b8 test_pixels = depth_test;
+
+    if constexpr (depth_test) {
+      // depth range of the triangle over the block, the plane is linear so
+      // the extremes are at the corners (of the outermost samples)
+      constexpr f32 pad = multisample ? sample_reach / 16.f : 0.f;
+      constexpr f32 extent = raster_block - 1 + 2 * pad;
+      f32 z00 = tri.z.eval((f32)(bx - tri.origin_x) - pad,
+                           (f32)(by - tri.origin_y) - pad);
+      f32 lo = z00 + std::min(tri.z.a, 0.f) * extent +
+               std::min(tri.z.b, 0.f) * extent;
+      f32 hi = z00 + std::max(tri.z.a, 0.f) * extent +
+               std::max(tri.z.b, 0.f) * extent;
+      lo = std::max(lo, tri.zmin);
+      hi = std::min(hi, tri.zmax);
+
+      depth_range stored = fb.get_hiz(bx / raster_block, by / raster_block);
+      if (!depth_range_may_pass(depth_func, lo, hi, stored)) {
+        if constexpr (profiling_enabled) {
+          u64 count = (u64)std::popcount(mask);
+          ctx.stats->pixels_tested += count;
+          ctx.stats->depth_rejects += count;
+        }
+        return;
+      }
+
+      test_pixels = !depth_range_all_pass(depth_func, lo, hi, stored);
+    }
+
+    if constexpr (multisample) {
+      for (block_mask m = mask; m; m &= m - 1) {
+        i32 bit = std::countr_zero(m);
+        u32 covered = 0;
+        for (u32 s = 0; s < Config::samples; ++s)
+          covered |= (u32)((sample_masks[s] >> bit) & 1) << s;
+        sample_live[bit] = (u8)covered;
+      }
+    }
+
+    // depth test every covered pixel first so only survivors get shaded
+    if (depth_test || ctx.depth_write) {
+      block_mask live = ctx.depth_write
+                            ? test_depth.template operator()<true>(
+                                  bx, by, mask, test_pixels)
+                            : test_depth.template operator()<false>(
+                                  bx, by, mask, test_pixels);
+      if constexpr (profiling_enabled && depth_test) {
+        ctx.stats->pixels_tested += (u64)std::popcount(mask);
+        ctx.stats->depth_rejects +=
+            (u64)(std::popcount(mask) - std::popcount(live));
+      }
+
+      mask = live;
+
+      if (ctx.depth_write && mask != 0)
+        fb.update_hiz(bx / raster_block, by / raster_block);
+    }
+
+    if constexpr (profiling_enabled)
+      ctx.stats->fragments_shaded += (u64)std::popcount(mask);
+
+    block_mask shaded = mask;
+    if constexpr (quad_shader<Shader>) {
+      shade_quads(bx, by, mask);
+    } else {
+      // only the live lanes go on to shading
+      while (mask) {
+        i32 bit = std::countr_zero(mask);
+        mask &= mask - 1;
+
+        i32 x = bx + (bit % raster_block);
+        i32 y = by + (bit / raster_block);
+
+        interpolate_planes(planes, varying_floats, tri.w,
+                           (f32)(x - tri.origin_x), (f32)(y - tri.origin_y),
+                           interp_buffer);
+
+        write_color(x, y, bit,
+                    pack_color(shader.fragment_shader(interp_buffer)));
+      }
+    }
+
+    if constexpr (Config::merge)
+      merge_block(bx, by, shaded);
+  };
+
+  block_classifier coarse(tri, coarse_block);
+  block_classifier fine(tri, raster_block);
+
+  // blocks are aligned to the (tile aligned) pixel grid
+  constexpr i32 coarse_align = ~(coarse_block - 1);
+  constexpr i32 block_align = ~(raster_block - 1);
+
+  for (i32 cy = ymin & coarse_align; cy < ymax; cy += coarse_block) {
+    for (i32 cx = xmin & coarse_align; cx < xmax; cx += coarse_block) {
+      block_class coarse_class = coarse.classify(cx, cy);
+      if (coarse_class == block_class::outside)
+        continue;
+
+      i32 by_end = std::min(cy + coarse_block, ymax);
+      i32 bx_end = std::min(cx + coarse_block, xmax);
+
+      for (i32 by = std::max(cy, ymin & block_align); by < by_end;
+           by += raster_block) {
+        i32 row_begin = std::max(ymin - by, 0);
+        i32 row_end = std::min(ymax - by, raster_block);
+
+        for (i32 bx = std::max(cx, xmin & block_align); bx < bx_end;
+             bx += raster_block) {
+          i32 col_begin = std::max(xmin - bx, 0);
+          i32 col_end = std::min(xmax - bx, raster_block);
+          u32 col_mask = ((1u << col_end) - 1) & ~((1u << col_begin) - 1);
+
+          // blocks inside a fully covered coarse block need no edge tests
+          block_class block = coarse_class == block_class::inside
+                                  ? block_class::inside
+                                  : fine.classify(bx, by);
+
+          if (block == block_class::outside)
+            continue;
+
+          if constexpr (multisample) {
+            block_mask sample_masks[Config::samples];
+            block_mask mask = 0;
+            for (u32 s = 0; s < Config::samples; ++s) {
+              sample_masks[s] =
+                  block == block_class::inside
+                      ? bounds_mask(col_mask, row_begin, row_end)
+                      : block_coverage(sample_edges[s], bx, by, col_mask,
+                                       row_begin, row_end);
+              mask |= sample_masks[s];
+            }
+
+            if (mask)
+              shade_block(bx, by, mask, sample_masks);
+          } else {
+            block_mask mask =
+                block == block_class::inside
+                    ? bounds_mask(col_mask, row_begin, row_end)
+                    : block_coverage(tri.edges, bx, by, col_mask, row_begin,
+                                     row_end);
+
+            if (mask)
+              shade_block(bx, by, mask, nullptr);
+          }
+        }
+      }
+    }
+  }
+}
+
+// kernel for draws where no fragment can pass the depth test
+static void discard_triangle(const raster_context &, const triangle_setup &,
+                             const f32 *, const rect &) {}
+
+// Kernel selection, done once per draw. Each step turns one piece of runtime
+// state into a template argument.
+template <typename Shader, u32 Samples, depth_kernel Depth>
+static raster_kernel_fn select_kernel_merge(const pipeline_state &state) {
+  // the blend equation itself is the output merger's, see
+  // select_output_merger, so it doesn't multiply the kernels
+  if (state.blend == blend_mode::opaque &&
+      state.color_write == color_write_all)
+    return draw_triangle<Shader, raster_config<Depth, false, Samples>>;
+  return draw_triangle<Shader, raster_config<Depth, true, Samples>>;
+}
+
+template <typename Shader, u32 Samples>
+static raster_kernel_fn select_kernel_depth(const pipeline_state &state) {
+  if (!state.depth.test_enable)
+    return select_kernel_merge<Shader, Samples, depth_kernel::off>(state);
+
+  switch (state.depth.func) {
+  case compare_func::never:
+    return discard_triangle;
+  case compare_func::always:
+    return select_kernel_merge<Shader, Samples, depth_kernel::off>(state);
+  case compare_func::less:
+    return select_kernel_merge<Shader, Samples, depth_kernel::less>(state);
+  case compare_func::less_equal:
+    return select_kernel_merge<Shader, Samples, depth_kernel::less_equal>(
+        state);
+  default:
+    return select_kernel_merge<Shader, Samples, depth_kernel::other>(state);
+  }
+}
+
+/// <summary>
+/// Picks the draw_triangle instantiation that matches the pipeline state
+/// and render target sample count of a draw.
+/// </summary>
+template <typename Shader>
+static raster_kernel_fn select_raster_kernel(const pipeline_state &state,
+                                             u32 samples = 1) {
+  if (samples > 1)
+    return select_kernel_depth<Shader, msaa_samples>(state);
+  return select_kernel_depth<Shader, 1>(state);
+}
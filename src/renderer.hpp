@@ -1,13 +1,23 @@
 #pragma once
 
+#include "bounds.hpp"
 #include "buffer.hpp"
+#include "clip.hpp"
 #include "framebuffer.hpp"
 #include "math_util.hpp"
+#include "pipeline_state.hpp"
+#include "profiler.hpp"
+#include "rasterizer.hpp"
+#include "scene_bvh.hpp"
 #include "shader_program.hpp"
-#include "varying.hpp"
+#include "texture.hpp"
+#include "thread_pool.hpp"
+#include "vertex_cache.hpp"
+#include "vertex_stage.hpp"
 #include "vector.hpp"
 #include <array>
 #include <memory>
+#include <vector>
 
 struct viewport {
   std::int32_t xmin, ymin, xmax, ymax;
@@ -21,6 +31,7 @@ struct viewport {
   math::vec4 transform(math::vec4 pt) const {
     pt.x = xmin + (xmax - xmin) * (0.5f + 0.5f * pt.x);
     pt.y = ymin + (ymax - ymin) * (0.5f - 0.5f * pt.y);
+    pt.z = 0.5f + 0.5f * pt.z;
     return pt;
   }
 
@@ -28,98 +39,463 @@ struct viewport {
   f32 get_aspect_hw() const { return (ymax - ymin) / f32(xmax - xmin); }
 };
 
-static void draw_triangle(framebuffer &fb, shader_program *program,
-                          math::vec4 positions[3],
-                          void *varyings) // packed: v0|v1|v2
-{
-  f32 area = math::det_2d(math::vec4{positions[1].x - positions[0].x,
-                                     positions[1].y - positions[0].y, 0, 0},
-                          math::vec4{positions[2].x - positions[0].x,
-                                     positions[2].y - positions[0].y, 0, 0});
-
-  if (area == 0.0f)
-    return;
-
-  f32 inv_area = 1.f / area;
-
-  i32 xmin = (i32)fminf(fminf(positions[0].x, positions[1].x), positions[2].x);
-  i32 xmax = (i32)fmaxf(fmaxf(positions[0].x, positions[1].x), positions[2].x);
-  i32 ymin = (i32)fminf(fminf(positions[0].y, positions[1].y), positions[2].y);
-  i32 ymax = (i32)fmaxf(fmaxf(positions[0].y, positions[1].y), positions[2].y);
-
-  u8 interp_buffer[256];
-  if (program->varying_size > sizeof(interp_buffer))
-    return;
-
-  for (i32 y = ymin; y <= ymax; ++y) {
-    for (i32 x = xmin; x <= xmax; ++x) {
-      math::vec4 p = {x + 0.5f, y + 0.5f, 0, 0};
-
-      f32 w0 = math::det_2d(
-          (math::vec4){positions[2].x - positions[1].x,
-                       positions[2].y - positions[1].y, 0, 0},
-          (math::vec4){p.x - positions[1].x, p.y - positions[1].y, 0, 0});
-
-      f32 w1 = math::det_2d(
-          (math::vec4){positions[0].x - positions[2].x,
-                       positions[0].y - positions[2].y, 0, 0},
-          (math::vec4){p.x - positions[2].x, p.y - positions[2].y, 0, 0});
-
-      f32 w2 = math::det_2d(
-          (math::vec4){positions[1].x - positions[0].x,
-                       positions[1].y - positions[0].y, 0, 0},
-          (math::vec4){p.x - positions[0].x, p.y - positions[0].y, 0, 0});
-
-      if (w0 > 0 || w1 > 0 || w2 > 0)
-        continue;
+static_assert(tile_size == framebuffer_tile_size,
+              "a raster tile covers exactly one framebuffer tile");
 
-      math::vec3 bary = {w0 * inv_area, w1 * inv_area, w2 * inv_area};
+// Totals over the draws since the last reset.
+struct pipeline_stats {
+  u64 vertices_shaded;
+  u64 primitives_submitted;  // triangles handed to draws
+  u64 primitives_rasterized; // triangles that reached the raster stage
+  u64 primitives_culled;
+  u64 pixels_tested;
+  u64 depth_rejects;
+  u64 fragments_shaded;
+  u64 draws_visible; // draws that passed the draw level frustum culling
+  u64 draws_culled;  // and that were skipped by it
+};
 
-      interpolate_vars(varyings, interp_buffer, program->varying_size, bary);
+struct rendering_pipeline {
 
-      math::vec4 color = program->fragment_shader(interp_buffer);
+  rendering_pipeline(framebuffer &fb,
+                     u32 num_threads = std::thread::hardware_concurrency())
+      : fb(&fb), pool(num_threads) {
+    tiles_x = (fb.get_width() + tile_size - 1) / tile_size;
+    tiles_y = (fb.get_height() + tile_size - 1) / tile_size;
+    bins.resize(tiles_x * tiles_y);
 
-      fb.put_pixel(x, y, to_color(color));
-    }
+    set_viewport({0, 0, (i32)fb.get_width(), (i32)fb.get_height()});
+    set_scissor({0, 0, (i32)fb.get_width(), (i32)fb.get_height()});
   }
-}
 
-struct rendering_pipeline {
+  void set_pipeline_state(const pipeline_state &state) { this->state = state; }
+
+  // Retargets the following draws, e.g. to the next buffer of a swap_chain.
+  // The binning grid, viewport and scissor are kept, so the size must match.
+  void set_render_target(framebuffer &fb) {
+    assert(fb.get_width() == this->fb->get_width());
+    assert(fb.get_height() == this->fb->get_height());
+    assert(fb.get_samples() == this->fb->get_samples());
+    this->fb = &fb;
+  }
+
+  // Binds tex to slot for the following draws, quad shaders read it through
+  // fragment_quad::textures. nullptr unbinds the slot.
+  void bind_texture(u32 slot, const texture *tex,
+                    const sampler_state &sampler = {}) {
+    assert(slot < max_texture_slots);
+    textures[slot] = texture_binding{tex, sampler};
+  }
+
+  // Sets the camera draws are culled against with cull_draw and cull_draws,
+  // the view projection matrix the vertex shaders apply after the model
+  // matrix.
+  void set_view_projection(const math::mat4 &view_proj) {
+    this->view_proj = view_proj;
+    update_view_frustum();
+  }
+
+  /// <summary>
+  /// Draw level frustum culling, before any vertex of the draw is shaded.
+  /// The bounding sphere is tested first, the box only when the sphere
+  /// straddles a plane. Counted in pipeline_stats either way.
+  /// </summary>
+  /// <param name="bounds">Bounds of the mesh in model space</param>
+  /// <param name="model">Model matrix of the draw</param>
+  /// <returns>true when the draw is outside the view and can be
+  /// skipped</returns>
+  b8 cull_draw(const mesh_bounds &bounds, const math::mat4 &model) {
+    frustum_test result = view_frustum.test(transform(bounds.sphere, model));
+    if (result == frustum_test::intersects)
+      result = view_frustum.test(transform(bounds.box, model));
+    return count_draw(result != frustum_test::outside);
+  }
+
+  // Same for bounds that are already in world space.
+  b8 cull_draw(const aabb &world_bounds) {
+    return count_draw(view_frustum.test(world_bounds) !=
+                      frustum_test::outside);
+  }
+
+  // Culls a whole scene at once: visible receives the indices of the objects
+  // of bvh that are in view.
+  void cull_draws(const scene_bvh &bvh, std::vector<u32> &visible) {
+    PROFILE_ZONE("cull_draws");
+    visible.clear();
+    counters.draws_culled += bvh.cull(view_frustum, visible);
+    counters.draws_visible += visible.size();
+  }
+
+  void set_viewport(const viewport &vp) {
+    this->vp = vp;
+
+    // the guard band reaches as far as setup_triangle can take coordinates,
+    // less a few pixels of slack for the rounding of the divide
+    f32 cx = 0.5f * (vp.xmin + vp.xmax);
+    f32 cy = 0.5f * (vp.ymin + vp.ymax);
+    f32 limit = max_raster_coord - 16.f;
+    gb.x = (limit - std::fabs(cx)) / (0.5f * (vp.xmax - vp.xmin));
+    gb.y = (limit - std::fabs(cy)) / (0.5f * (vp.ymax - vp.ymin));
 
-  rendering_pipeline(framebuffer &fb) : fb(fb) {
-    // todo: un-hardcode
-    vp = {0, 0, 800, 600};
+    update_raster_rect();
+    update_view_frustum();
+  }
+
+  // Pixels outside the scissor rectangle are never touched by a draw.
+  void set_scissor(const rect &scissor) {
+    this->scissor = scissor;
+    update_raster_rect();
+  }
+
+  // Triangles rejected before the raster stage, by reason. Triangles split
+  // by clipping are counted once per part. Accumulates until reset.
+  const cull_stats &get_cull_stats() const { return stats; }
+  void reset_cull_stats() { stats.reset(); }
+
+  // Accumulates until reset. Only the primitive and draw counts are counted
+  // when profiling is compiled out, see profiler.hpp.
+  pipeline_stats get_pipeline_stats() const {
+    pipeline_stats out = counters;
+    out.primitives_rasterized = stats.get(cull_result::visible);
+    out.primitives_culled = stats.culled();
+    return out;
+  }
+  void reset_pipeline_stats() {
+    counters = {};
+    stats.reset();
   }
 
   void execute_pipeline(shader_program *program, vertex_buffer vbuf,
                         i32 vertex_count) {
+    PROFILE_ZONE("execute_pipeline");
+    if (program->fragment_shader_quad)
+      draw(program_quad_shader{program}, vbuf, vertex_count);
+    else
+      draw(program_shader{program}, vbuf, vertex_count);
+  }
 
+  void draw_indexed(shader_program *program, vertex_buffer vbuf,
+                    index_buffer ibuf, i32 index_count) {
+    PROFILE_ZONE("draw_indexed");
+    if (program->fragment_shader_quad)
+      draw_indexed(program_quad_shader{program}, vbuf, ibuf, index_count);
+    else
+      draw_indexed(program_shader{program}, vbuf, ibuf, index_count);
+  }
+
+  /// <summary>
+  /// Draws a non-indexed triangle list. The raster kernel is specialized for
+  /// Shader and the current pipeline state, see select_raster_kernel.
+  /// </summary>
+  template <typename Shader>
+  void draw(const Shader &shader, vertex_buffer vbuf, i32 vertex_count) {
     assert(vertex_count % 3 == 0);
-    size n_triangles = vertex_count / 3;
+    draw_triangles<false>(shader, vbuf, nullptr, vertex_count / 3);
+  }
 
-    // for each triangle...
-    for (size tri = 0; tri < n_triangles; ++tri) {
-      u8 vars[3 * 256];
-      std::array<math::vec4, 3> positions;
+  /// <summary>
+  /// Draws an indexed triangle list. Vertices go through the post transform
+  /// cache, so each unique index is shaded once per draw no matter how many
+  /// triangles share it.
+  /// </summary>
+  template <typename Shader>
+  void draw_indexed(const Shader &shader, vertex_buffer vbuf,
+                    index_buffer ibuf, i32 index_count) {
+    assert(index_count % 3 == 0);
+    draw_triangles<true>(shader, vbuf, &ibuf, index_count / 3);
+  }
+
+private:
+  template <b8 Indexed, typename Shader>
+  void draw_triangles(const Shader &shader, vertex_buffer vbuf,
+                      const index_buffer *ibuf, size n_triangles) {
+    size varying_size = shader.varying_size();
+    assert(varying_size <= max_varying_size);
+    assert(varying_size % sizeof(f32) == 0);
+    u32 varying_floats = (u32)(varying_size / sizeof(f32));
+    size tri_planes_size = 3 * plane_floats(varying_floats);
+    counters.primitives_submitted += n_triangles;
+
+    // vertex stage: shade every vertex the draw references once, in
+    // parallel, into the arena
+    {
+      PROFILE_ZONE("vertex_stage");
+      vertex_stage<Indexed>(shader, vbuf, ibuf, n_triangles);
+    }
+
+    if constexpr (profiling_enabled)
+      counters.vertices_shaded += arena.get_count();
 
-      assert(program->varying_size < 256);
+    {
+      PROFILE_ZONE("primitive_assembly");
+      assemble_triangles<Indexed>(n_triangles, varying_floats);
+    }
+
+    PROFILE_ZONE("raster");
+
+    active_tiles.clear();
+    for (u32 tile = 0; tile < (u32)bins.size(); ++tile) {
+      if (!bins[tile].empty())
+        active_tiles.push_back(tile);
+    }
+
+    raster_kernel_fn kernel =
+        select_raster_kernel<Shader>(state, fb->get_samples());
+    raster_context ctx = {fb,
+                          &shader,
+                          varying_floats,
+                          nullptr,
+                          textures.data(),
+                          select_output_merger(state.blend),
+                          color_write_bytes(state.color_write),
+                          state.depth.func,
+                          state.depth.write_enable};
+
+    worker_stats.assign(pool.get_num_threads(), raster_stats{});
+    b8 uses_depth = state.depth.test_enable || state.depth.write_enable;
+
+    // back end: every tile walks its own bin in submission order, so the
+    // result is identical to drawing the triangles one after another
+    pool.parallel_for((u32)active_tiles.size(), [&](u32 index, u32 worker) {
+      PROFILE_ZONE("raster_tile");
+      u32 tile = active_tiles[index];
+      rect clip = get_tile_rect(tile);
+
+      raster_context tile_ctx = ctx;
+      tile_ctx.stats = &worker_stats[worker];
+
+      // the pending fast clears of the tile are written by its worker,
+      // right before the tile is drawn into
+      fb->touch_tile(tile, true, uses_depth);
+
+      for (u32 tri : bins[tile]) {
+        kernel(tile_ctx, triangles[tri],
+               planes.data() + tri * tri_planes_size, clip);
+      }
+    });
+
+    if constexpr (profiling_enabled) {
+      for (const raster_stats &ws : worker_stats) {
+        counters.pixels_tested += ws.pixels_tested;
+        counters.depth_rejects += ws.depth_rejects;
+        counters.fragments_shaded += ws.fragments_shaded;
+      }
+
+      PROFILE_COUNTER("vertices_shaded", counters.vertices_shaded);
+      PROFILE_COUNTER("primitives_culled", stats.culled());
+      PROFILE_COUNTER("pixels_tested", counters.pixels_tested);
+      PROFILE_COUNTER("depth_rejects", counters.depth_rejects);
+      PROFILE_COUNTER("fragments_shaded", counters.fragments_shaded);
+    }
+  }
+
+  template <b8 Indexed, typename Shader>
+  void vertex_stage(const Shader &shader, vertex_buffer vbuf,
+                    const index_buffer *ibuf, size n_triangles) {
+    if constexpr (Indexed) {
+      cache.begin_draw(n_triangles * 3);
+      vertex_ids.clear();
+      tri_slots.resize(n_triangles * 3);
+
+      for (size i = 0; i < n_triangles * 3; ++i) {
+        u32 index = ibuf->get(i);
+        u32 slot;
+        if (!cache.lookup(index, slot))
+          vertex_ids.push_back(index);
+        tri_slots[i] = slot;
+      }
+
+      shade_vertices(pool, shader, vbuf, vertex_ids.data(),
+                     (u32)vertex_ids.size(), vp.get_aspect_hw(), arena);
+    } else {
+      shade_vertices(pool, shader, vbuf, nullptr, (u32)(n_triangles * 3),
+                     vp.get_aspect_hw(), arena);
+    }
+  }
+
+  // primitive assembly: reads the corners back from the arena, clips, sets
+  // up and bins each triangle
+  template <b8 Indexed>
+  void assemble_triangles(size n_triangles, u32 varying_floats) {
+    triangles.clear();
+    planes.clear();
+
+    for (std::vector<u32> &bin : bins)
+      bin.clear();
+
+    const guard_band frustum = {1.f, 1.f};
+
+    for (size tri = 0; tri < n_triangles; ++tri) {
+      clip_vertex corners[max_clip_vertices];
+      u32 outside_all = ~0u;
+      u32 outside_any = 0;
 
       for (size v = 0; v < 3; ++v) {
-        void *vtx_ptr = vbuf.data + (tri * 3 + v) * vbuf.stride;
+        u32 slot = Indexed ? tri_slots[tri * 3 + v] : (u32)(tri * 3 + v);
 
-        void *out_vars = vars + v * program->varying_size;
+        corners[v].pos = arena.get_position(slot);
+        arena.get_varyings(slot, corners[v].vars);
 
-        program->vertex_shader(vtx_ptr, &positions[v], out_vars);
+        outside_all &= clip_outcode(corners[v].pos, frustum);
+        outside_any |= clip_outcode(corners[v].pos, gb);
+      }
 
-        positions[v].x *= vp.get_aspect_hw();
-        positions[v] = vp.transform(positions[v]);
+      // entirely on the outside of one frustum plane
+      if (outside_all) {
+        stats.add(cull_result::frustum);
+        continue;
       }
 
-      draw_triangle(fb, program, positions.data(), vars);
+      // the common case, inside near/far and the guard band
+      if (!outside_any) {
+        emit_triangle(corners[0], corners[1], corners[2], varying_floats);
+        continue;
+      }
+
+      u32 count = clip_polygon(corners, 3, outside_any, gb, varying_floats);
+      if (count < 3)
+        stats.add(cull_result::clipped);
+
+      // the clipped polygon is convex, fan it out from the first vertex
+      for (u32 v = 2; v < count; ++v) {
+        emit_triangle(corners[0], corners[v - 1], corners[v],
+                      varying_floats);
+      }
     }
   }
 
-private:
-  framebuffer &fb;
+  // Perspective divide, viewport transform, culling, setup and binning of
+  // one triangle in clip space. Past the divide w holds 1 / w.
+  void emit_triangle(const clip_vertex &a, const clip_vertex &b,
+                     const clip_vertex &c, u32 varying_floats) {
+    const clip_vertex *corners[3] = {&a, &b, &c};
+    std::array<math::vec4, 3> positions;
+
+    for (size v = 0; v < 3; ++v) {
+      const math::vec4 &p = corners[v]->pos;
+
+      // left after near clipping only by projections that do not keep
+      // w positive in front of the near plane
+      if (!(p.w > 0.f)) {
+        stats.add(cull_result::clipped);
+        return;
+      }
+
+      f32 inv_w = 1.f / p.w;
+      math::vec4 ndc = {p.x * inv_w, p.y * inv_w, p.z * inv_w, inv_w};
+      positions[v] = vp.transform(ndc);
+    }
+
+    triangle_setup setup;
+    cull_result result = setup_triangle(positions.data(), state.cull, setup,
+                                        fb->get_samples());
+
+    if (result == cull_result::visible &&
+        !bin_triangle((u32)triangles.size(), setup))
+      result = cull_result::scissor;
+
+    stats.add(result);
+    if (result != cull_result::visible)
+      return;
+
+    triangles.push_back(setup);
+
+    const f32 *vars[3] = {a.vars, b.vars, c.vars};
+    size offset = planes.size();
+    planes.resize(offset + 3 * plane_floats(varying_floats));
+    setup_varying_planes(setup, positions.data(), vars, varying_floats,
+                         planes.data() + offset);
+  }
+
+  // returns false if the triangle landed in no bin
+  b8 bin_triangle(u32 tri, const triangle_setup &setup) {
+    const rect &bounds = setup.bounds;
+    i32 xmin = std::max(bounds.xmin, raster_rect.xmin);
+    i32 ymin = std::max(bounds.ymin, raster_rect.ymin);
+    i32 xmax = std::min(bounds.xmax, raster_rect.xmax) - 1;
+    i32 ymax = std::min(bounds.ymax, raster_rect.ymax) - 1;
+
+    if (xmin > xmax || ymin > ymax)
+      return false;
+
+    b8 binned = false;
+
+    // tiles the bounding box touches but the triangle misses (long slivers)
+    // never see it
+    block_classifier tile_classifier(setup, tile_size);
+
+    for (i32 ty = ymin / tile_size; ty <= ymax / tile_size; ++ty) {
+      for (i32 tx = xmin / tile_size; tx <= xmax / tile_size; ++tx) {
+        if (tile_classifier.classify(tx * tile_size, ty * tile_size) ==
+            block_class::outside)
+          continue;
+
+        bins[ty * tiles_x + tx].push_back(tri);
+        binned = true;
+      }
+    }
+
+    return binned;
+  }
+
+  rect get_tile_rect(u32 tile) const {
+    i32 tx = (i32)(tile % tiles_x);
+    i32 ty = (i32)(tile / tiles_x);
+
+    return rect{std::max(tx * tile_size, raster_rect.xmin),
+                std::max(ty * tile_size, raster_rect.ymin),
+                std::min((tx + 1) * tile_size, raster_rect.xmax),
+                std::min((ty + 1) * tile_size, raster_rect.ymax)};
+  }
+
+  // the vertex stage scales clip space x by the aspect of the viewport, so
+  // the planes are taken from the matrix with that scale applied
+  void update_view_frustum() {
+    math::mat4 aspect =
+        math::mat4::scale(math::vec3{vp.get_aspect_hw(), 1.f, 1.f});
+    view_frustum = frustum::from_matrix(aspect * view_proj);
+  }
+
+  inline b8 count_draw(b8 visible) {
+    if (visible)
+      ++counters.draws_visible;
+    else
+      ++counters.draws_culled;
+    return !visible;
+  }
+
+  // viewport, scissor and framebuffer intersected, triangle bounds are
+  // clamped to it
+  void update_raster_rect() {
+    raster_rect.xmin = std::max({vp.xmin, scissor.xmin, 0});
+    raster_rect.ymin = std::max({vp.ymin, scissor.ymin, 0});
+    raster_rect.xmax =
+        std::min({vp.xmax, scissor.xmax, (i32)fb->get_width()});
+    raster_rect.ymax =
+        std::min({vp.ymax, scissor.ymax, (i32)fb->get_height()});
+  }
+
+  framebuffer *fb;
   viewport vp;
+  guard_band gb;
+  rect scissor;
+  rect raster_rect;
+  cull_stats stats;
+  pipeline_stats counters = {};
+  std::vector<raster_stats> worker_stats;
+  pipeline_state state;
+  math::mat4 view_proj = math::mat4::identity();
+  frustum view_frustum;
+  std::array<texture_binding, max_texture_slots> textures;
+  thread_pool pool;
+
+  u32 tiles_x, tiles_y;
+  std::vector<triangle_setup> triangles;
+  std::vector<f32> planes;
+  vertex_arena arena;
+  vertex_cache cache;
+  std::vector<u32> vertex_ids;
+  std::vector<u32> tri_slots;
+  std::vector<std::vector<u32>> bins;
+  std::vector<u32> active_tiles;
 };
@@ -0,0 +1,118 @@
+#include "scene_bvh.hpp"
+#include <algorithm>
+
+void scene_bvh::build(const aabb *boxes, u32 count) {
+  nodes.clear();
+  object_boxes.assign(boxes, boxes + count);
+  objects.resize(count);
+  for (u32 i = 0; i < count; ++i)
+    objects[i] = i;
+
+  if (count == 0)
+    return;
+
+  nodes.reserve(2 * (count / bvh_leaf_size + 1));
+  nodes.push_back({});
+  build_node(0, boxes, 0, count);
+}
+
+// Fills in node index for objects[begin, end). Children are appended to
+// nodes, so no reference into it is held across the recursion.
+void scene_bvh::build_node(u32 index, const aabb *boxes, u32 begin,
+                           u32 end) {
+  aabb box = aabb::empty();
+  aabb centers = aabb::empty();
+  for (u32 i = begin; i < end; ++i) {
+    box.grow(boxes[objects[i]]);
+    centers.grow(boxes[objects[i]].center());
+  }
+
+  nodes[index].box = box;
+  nodes[index].objects_below = end - begin;
+
+  if (end - begin <= bvh_leaf_size) {
+    nodes[index].first = begin;
+    nodes[index].count = end - begin;
+    return;
+  }
+
+  math::vec3 size = centers.max - centers.min;
+  i32 axis = 0;
+  if (size.y > size.values[axis])
+    axis = 1;
+  if (size.z > size.values[axis])
+    axis = 2;
+
+  u32 mid = begin + (end - begin) / 2;
+  std::nth_element(objects.begin() + begin, objects.begin() + mid,
+                   objects.begin() + end, [&](u32 a, u32 b) {
+                     return boxes[a].center().values[axis] <
+                            boxes[b].center().values[axis];
+                   });
+
+  // the children are next to each other
+  u32 left = (u32)nodes.size();
+  nodes.push_back({});
+  nodes.push_back({});
+  nodes[index].first = left;
+  nodes[index].count = 0;
+
+  build_node(left, boxes, begin, mid);
+  build_node(left + 1, boxes, mid, end);
+}
+
+void scene_bvh::append_subtree(u32 index, std::vector<u32> &visible) const {
+  const node &n = nodes[index];
+  if (n.count) {
+    visible.insert(visible.end(), objects.begin() + n.first,
+                   objects.begin() + n.first + n.count);
+    return;
+  }
+  append_subtree(n.first, visible);
+  append_subtree(n.first + 1, visible);
+}
+
+u32 scene_bvh::cull(const frustum &f, std::vector<u32> &visible) const {
+  if (nodes.empty())
+    return 0;
+
+  u32 culled = 0;
+
+  // the tree is balanced, so its depth is logarithmic in the object count
+  u32 stack[64];
+  u32 top = 0;
+  stack[top++] = 0;
+
+  while (top) {
+    u32 index = stack[--top];
+    const node &n = nodes[index];
+
+    frustum_test result = f.test(n.box);
+    if (result == frustum_test::outside) {
+      culled += n.objects_below;
+      continue;
+    }
+
+    if (result == frustum_test::inside) {
+      append_subtree(index, visible);
+      continue;
+    }
+
+    if (n.count) {
+      // a partially visible leaf tests its objects one by one
+      for (u32 i = n.first; i < n.first + n.count; ++i) {
+        u32 object = objects[i];
+        if (f.test(object_boxes[object]) == frustum_test::outside)
+          ++culled;
+        else
+          visible.push_back(object);
+      }
+      continue;
+    }
+
+    stack[top++] = n.first + 1;
+    stack[top++] = n.first;
+  }
+
+  return culled;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "bounds.hpp"
+#include "types.hpp"
+#include <vector>
+
+// Objects per leaf of a scene_bvh at most.
+static constexpr u32 bvh_leaf_size = 4;
+
+/// <summary>
+/// Bounding volume hierarchy over the world space boxes of the objects of a
+/// scene, for culling whole draws against the view frustum. Objects are
+/// referred to by their index in the array the tree was built from.
+/// </summary>
+struct scene_bvh {
+  // Rebuilds the tree, splitting at the median of the longest axis of the
+  // object centers.
+  void build(const aabb *boxes, u32 count);
+
+  /// <summary>
+  /// Appends the objects whose boxes intersect f to visible. Subtrees that
+  /// are completely inside or outside f are not looked into any further.
+  /// </summary>
+  /// <returns>The number of objects culled</returns>
+  u32 cull(const frustum &f, std::vector<u32> &visible) const;
+
+  inline u32 get_count() const { return (u32)objects.size(); }
+
+private:
+  struct node {
+    aabb box;
+    // leaves: objects[first, first + count), inner nodes: children first
+    // and first + 1, count 0
+    u32 first, count;
+    u32 objects_below; // in the whole subtree
+  };
+
+  void build_node(u32 index, const aabb *boxes, u32 begin, u32 end);
+  void append_subtree(u32 index, std::vector<u32> &visible) const;
+
+  std::vector<node> nodes;
+  std::vector<u32> objects; // object indices, grouped by leaf
+  std::vector<aabb> object_boxes; // by object index
+};
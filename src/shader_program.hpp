@@ -1,16 +1,99 @@
 #pragma once
 
 #include "vector.hpp"
+#include <concepts>
 
 typedef void (*vertex_shader_fn)(const void *in_vertex,
                                  math::vec4 *out_position, void *out_varying);
 
 typedef math::vec4 (*fragment_shader_fn)(void *varying);
 
+// Upper bound for varying_size, in bytes.
+static constexpr size max_varying_size = 256;
+
+// lane of pixel (x, y) inside a 2x2 quad is (y & 1) * 2 + (x & 1)
+static constexpr u32 quad_lanes = 4;
+
+struct texture_binding;
+
+// A 2x2 quad of fragments with its varyings in structure of arrays form.
+struct fragment_quad {
+  // lanes that are covered and passed the depth test, the others are helper
+  // lanes that only exist for the derivatives and are not written
+  u32 mask;
+
+  // float i of the varying of lane l is at varyings[i * quad_lanes + l],
+  // 16 byte aligned so each float can be loaded as one __m128
+  const f32 *varyings;
+
+  // the max_texture_slots textures bound to the draw, see
+  // rendering_pipeline::bind_texture and texture_binding::sample_quad
+  const texture_binding *textures;
+
+  inline f32 get(u32 i, u32 lane) const {
+    return varyings[i * quad_lanes + lane];
+  }
+
+  // screen space derivatives of varying float i, shared by the whole quad
+  inline f32 ddx(u32 i) const { return get(i, 1) - get(i, 0); }
+  inline f32 ddy(u32 i) const { return get(i, 2) - get(i, 0); }
+};
+
+typedef void (*fragment_shader_quad_fn)(const fragment_quad &quad,
+                                        math::vec4 out_colors[quad_lanes]);
+
 typedef struct {
   // size_t vertex_stride;
   size_t varying_size;
 
   vertex_shader_fn vertex_shader;
   fragment_shader_fn fragment_shader;
+
+  // optional, used instead of fragment_shader when set
+  fragment_shader_quad_fn fragment_shader_quad;
 } shader_program;
+
+
+// Shaders can also be handed to rendering_pipeline::draw as functors, which
+// lets the calls inline into the raster kernels:
+//
+// struct my_shader {
+//   size varying_size() const;
+//   void vertex_shader(const void *in_vertex, math::vec4 *out_position,
+//                      void *out_varying) const;
+//   // at least one of
+//   math::vec4 fragment_shader(void *varying) const;
+//   void fragment_shader_quad(const fragment_quad &quad,
+//                             math::vec4 out_colors[quad_lanes]) const;
+// };
+//
+// fragment_shader_quad is used when present.
+template <typename Shader>
+concept quad_shader = requires(const Shader &shader, const fragment_quad &quad,
+                               math::vec4 *out_colors) {
+  shader.fragment_shader_quad(quad, out_colors);
+};
+
+// Adapts a shader_program to the functor interface.
+struct program_shader {
+  const shader_program *program;
+
+  inline size varying_size() const { return program->varying_size; }
+
+  inline void vertex_shader(const void *in_vertex, math::vec4 *out_position,
+                            void *out_varying) const {
+    program->vertex_shader(in_vertex, out_position, out_varying);
+  }
+
+  inline math::vec4 fragment_shader(void *varying) const {
+    return program->fragment_shader(varying);
+  }
+};
+
+// Same as program_shader for programs that set fragment_shader_quad.
+struct program_quad_shader : program_shader {
+  inline void fragment_shader_quad(const fragment_quad &quad,
+                                   math::vec4 out_colors[quad_lanes]) const {
+    program->fragment_shader_quad(quad, out_colors);
+  }
+};
@@ -0,0 +1,87 @@
+#include "swap_chain.hpp"
+
+#include "profiler.hpp"
+
+swap_chain::swap_chain(u32 width, u32 height, u32 num_buffers,
+                       present_mode mode, framebuffer_layout layout)
+    : mode(mode) {
+  // one buffer can't be rendered and presented at the same time
+  if (num_buffers < 2)
+    num_buffers = 2;
+
+  for (u32 i = 0; i < num_buffers; ++i) {
+    buffers.push_back(std::make_unique<framebuffer>(width, height, layout));
+    free_buffers.push_back(buffers.back().get());
+  }
+}
+
+framebuffer *swap_chain::acquire() {
+  PROFILE_ZONE("swap_chain_acquire");
+  std::unique_lock lock(mutex);
+
+  if (mode == present_mode::mailbox && free_buffers.empty() &&
+      !queued.empty()) {
+    // the oldest queued frame is superseded by the one about to be drawn
+    framebuffer *fb = queued.front();
+    queued.pop_front();
+    ++dropped;
+    return fb;
+  }
+
+  free_cv.wait(lock, [&] { return closed || !free_buffers.empty(); });
+  if (closed)
+    return nullptr;
+
+  framebuffer *fb = free_buffers.back();
+  free_buffers.pop_back();
+  return fb;
+}
+
+void swap_chain::submit(framebuffer *fb) {
+  {
+    std::lock_guard lock(mutex);
+    queued.push_back(fb);
+
+    // only the newest frame is ever presented in mailbox mode
+    if (mode == present_mode::mailbox) {
+      while (queued.size() > 1) {
+        free_buffers.push_back(queued.front());
+        queued.pop_front();
+        ++dropped;
+      }
+    }
+  }
+  queued_cv.notify_one();
+}
+
+framebuffer *swap_chain::acquire_present(std::chrono::milliseconds timeout) {
+  std::unique_lock lock(mutex);
+
+  if (!queued_cv.wait_for(lock, timeout,
+                          [&] { return closed || !queued.empty(); }))
+    return nullptr;
+
+  if (queued.empty())
+    return nullptr;
+
+  framebuffer *fb = queued.front();
+  queued.pop_front();
+  return fb;
+}
+
+void swap_chain::release(framebuffer *fb) {
+  {
+    std::lock_guard lock(mutex);
+    free_buffers.push_back(fb);
+  }
+  free_cv.notify_one();
+}
+
+void swap_chain::close() {
+  {
+    std::lock_guard lock(mutex);
+    closed = true;
+  }
+  free_cv.notify_all();
+  queued_cv.notify_all();
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "framebuffer.hpp"
+#include "types.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// How the frames queued for present are consumed.
+enum class present_mode : u8 {
+  // every frame is presented in order and the renderer waits while all
+  // buffers are in use: the most throughput, up to num_buffers - 1 frames
+  // of latency
+  fifo,
+  // only the newest queued frame is presented, a renderer short of buffers
+  // takes back the queued frame instead of waiting: the least latency,
+  // frames may be dropped. Wants 3 buffers so present isn't starved.
+  mailbox,
+};
+
+/// <summary>
+/// A fixed set of framebuffers handed back and forth between one render
+/// thread and one present thread, so presenting frame N overlaps rendering
+/// frame N + 1. The queue of finished frames is bounded by the number of
+/// buffers, 2 for double and 3 for triple buffering.
+/// </summary>
+struct swap_chain {
+  swap_chain(u32 width, u32 height, u32 num_buffers = 2,
+             present_mode mode = present_mode::fifo,
+             framebuffer_layout layout = framebuffer_layout::linear);
+
+  swap_chain(const swap_chain &) = delete;
+  swap_chain &operator=(const swap_chain &) = delete;
+
+  // Render side. Blocks until a buffer is free, nullptr once closed.
+  framebuffer *acquire();
+  void submit(framebuffer *fb);
+
+  // Present side. Waits up to timeout for a finished frame, nullptr if there
+  // is none. Every frame returned has to be released once it is presented.
+  framebuffer *acquire_present(std::chrono::milliseconds timeout);
+  void release(framebuffer *fb);
+
+  // wakes up and turns away both sides, used to shut down
+  void close();
+
+  inline u32 get_num_buffers() const { return (u32)buffers.size(); }
+  inline present_mode get_mode() const { return mode; }
+
+  // frames replaced in mailbox mode before they were presented
+  inline u64 get_dropped() const { return dropped; }
+
+private:
+  std::vector<std::unique_ptr<framebuffer>> buffers;
+  present_mode mode;
+
+  std::mutex mutex;
+  std::condition_variable free_cv;
+  std::condition_variable queued_cv;
+
+  std::vector<framebuffer *> free_buffers;
+  std::deque<framebuffer *> queued; // oldest first
+  u64 dropped = 0;
+  b8 closed = false;
+};
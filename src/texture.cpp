@@ -0,0 +1,83 @@
+#include "texture.hpp"
+
+static u32 blocks_for(u32 texels) {
+  return (texels + texel_block - 1) >> texel_block_shift;
+}
+
+// Scatters row major texels into the blocks of a level.
+static void store_level(texel_line *blocks, u32 blocks_x, const color *src,
+                        u32 width, u32 height) {
+  for (u32 y = 0; y < height; ++y) {
+    const color *row = src + (size)y * width;
+    texel_line *block_row = blocks + (y >> texel_block_shift) * blocks_x;
+    u32 in_row = (y & (texel_block - 1)) * texel_block;
+
+    for (u32 bx = 0; bx < blocks_x; ++bx) {
+      u32 x0 = bx << texel_block_shift;
+      u32 count = std::min(texel_block, width - x0);
+      std::copy_n(row + x0, count, block_row[bx].texels + in_row);
+    }
+  }
+}
+
+// 2x2 box filter, odd sizes reuse the last row or column.
+static void downsample(const color *src, u32 width, u32 height, color *dst,
+                       u32 dst_width, u32 dst_height) {
+  for (u32 y = 0; y < dst_height; ++y) {
+    u32 y0 = std::min(2 * y, height - 1);
+    u32 y1 = std::min(2 * y + 1, height - 1);
+
+    for (u32 x = 0; x < dst_width; ++x) {
+      u32 x0 = std::min(2 * x, width - 1);
+      u32 x1 = std::min(2 * x + 1, width - 1);
+
+      const u8 *c[4] = {(const u8 *)&src[(size)y0 * width + x0],
+                        (const u8 *)&src[(size)y0 * width + x1],
+                        (const u8 *)&src[(size)y1 * width + x0],
+                        (const u8 *)&src[(size)y1 * width + x1]};
+      u8 *out = (u8 *)&dst[(size)y * dst_width + x];
+      for (u32 k = 0; k < sizeof(color); ++k)
+        out[k] = (u8)((c[0][k] + c[1][k] + c[2][k] + c[3][k] + 2) / 4);
+    }
+  }
+}
+
+texture::texture(const color *pixels, u32 width, u32 height, b8 mipmaps) {
+  assert(width > 0 && height > 0);
+
+  // sizes and block offsets of the chain first, so all levels share one
+  // allocation
+  std::vector<size> offsets;
+  size total = 0;
+  for (u32 w = width, h = height;; w = std::max(w / 2, 1u),
+           h = std::max(h / 2, 1u)) {
+    levels.push_back(texture_level{w, h, blocks_for(w), nullptr});
+    offsets.push_back(total);
+    total += (size)blocks_for(w) * blocks_for(h);
+
+    if (!mipmaps || (w == 1 && h == 1))
+      break;
+  }
+
+  storage = std::make_unique<texel_line[]>(total);
+  for (size i = 0; i < levels.size(); ++i)
+    levels[i].blocks = storage.get() + offsets[i];
+
+  store_level(storage.get(), levels[0].blocks_x, pixels, width, height);
+
+  // every level is filtered from the one above it, kept row major so the
+  // box filter reads it linearly
+  std::vector<color> prev(pixels, pixels + (size)width * height);
+  std::vector<color> next;
+  for (size i = 1; i < levels.size(); ++i) {
+    const texture_level &above = levels[i - 1];
+    texture_level &level = levels[i];
+
+    next.resize((size)level.width * level.height);
+    downsample(prev.data(), above.width, above.height, next.data(),
+               level.width, level.height);
+    store_level(storage.get() + offsets[i], level.blocks_x, next.data(),
+                level.width, level.height);
+    prev.swap(next);
+  }
+}
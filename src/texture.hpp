@@ -0,0 +1,244 @@
+#pragma once
+
+#include "color.hpp"
+#include "shader_program.hpp"
+#include "types.hpp"
+#include "vector.hpp"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <immintrin.h>
+#include <memory>
+#include <vector>
+
+enum class texture_filter : u8 { nearest, bilinear };
+
+enum class mip_filter : u8 {
+  none,    // always level 0
+  nearest, // the level closest to the lod
+  linear,  // blend of the two levels around the lod
+};
+
+enum class texture_wrap : u8 { repeat, clamp };
+
+struct sampler_state {
+  texture_filter filter = texture_filter::bilinear;
+  mip_filter mip = mip_filter::nearest;
+  texture_wrap wrap = texture_wrap::repeat;
+};
+
+// Texels are stored in texel_block x texel_block blocks of one cache line
+// each, row major inside a block and blocks row major inside a level, so a
+// bilinear footprint touches one or two lines instead of two rows.
+static constexpr u32 texel_block = 4;
+static constexpr u32 texel_block_shift = 2;
+
+struct alignas(64) texel_line {
+  color texels[texel_block * texel_block];
+};
+
+static_assert(sizeof(texel_line) == 64, "a texel block is one cache line");
+
+struct texture_level {
+  u32 width, height;
+  u32 blocks_x;             // blocks per row
+  const texel_line *blocks; // into the storage of the texture
+
+  inline const color *texel_ptr(u32 x, u32 y) const {
+    const texel_line &line =
+        blocks[(y >> texel_block_shift) * blocks_x + (x >> texel_block_shift)];
+    return &line.texels[(y & (texel_block - 1)) * texel_block +
+                        (x & (texel_block - 1))];
+  }
+};
+
+/// <summary>
+/// An RGBA8 texture with its full mip chain, built from row major pixels
+/// when the texture is created and immutable after that.
+/// </summary>
+struct texture {
+  /// <param name="pixels">width * height row major texels</param>
+  /// <param name="mipmaps">Generate the mip chain down to 1x1, otherwise
+  /// only level 0 exists</param>
+  texture(const color *pixels, u32 width, u32 height, b8 mipmaps = true);
+
+  inline u32 get_width() const { return levels[0].width; }
+  inline u32 get_height() const { return levels[0].height; }
+  inline u32 get_levels() const { return (u32)levels.size(); }
+  inline const texture_level &get_level(u32 level) const {
+    assert(level < levels.size());
+    return levels[level];
+  }
+
+  color get_texel(u32 level, u32 x, u32 y) const {
+    const texture_level &l = get_level(level);
+    assert(x < l.width);
+    assert(y < l.height);
+    return *l.texel_ptr(x, y);
+  }
+
+private:
+  std::vector<texture_level> levels;
+  std::unique_ptr<texel_line[]> storage;
+};
+
+namespace texture_detail {
+// Integer texel coordinate x of a level size wide after wrapping.
+static inline u32 wrap_coord(i32 x, u32 size, texture_wrap wrap) {
+  if (wrap == texture_wrap::clamp)
+    return (u32)std::clamp(x, 0, (i32)size - 1);
+
+  i32 m = x % (i32)size;
+  return (u32)(m < 0 ? m + (i32)size : m);
+}
+
+// 1/255 per channel
+static inline __m128 unpack_color(__m128i c16) {
+  __m128i c32 = _mm_unpacklo_epi16(c16, _mm_setzero_si128());
+  return _mm_mul_ps(_mm_cvtepi32_ps(c32), _mm_set1_ps(1.f / 255.f));
+}
+
+// Bilinear filter weights are 7 bit fixed point, which keeps the products of
+// the 16 bit lerps below inside a signed lane.
+static constexpr i32 weight_bits = 7;
+static constexpr f32 weight_scale = 1 << weight_bits;
+
+static inline __m128 sample_level(const texture_level &level,
+                                  const sampler_state &sampler, f32 u,
+                                  f32 v) {
+  if (sampler.wrap == texture_wrap::repeat) {
+    // keeps the fixed point coordinates small no matter how often u and v
+    // repeat
+    u -= std::floor(u);
+    v -= std::floor(v);
+  } else {
+    u = std::clamp(u, 0.f, 1.f);
+    v = std::clamp(v, 0.f, 1.f);
+  }
+
+  const __m128i zero = _mm_setzero_si128();
+
+  if (sampler.filter == texture_filter::nearest) {
+    u32 x = wrap_coord((i32)(u * level.width), level.width, sampler.wrap);
+    u32 y = wrap_coord((i32)(v * level.height), level.height, sampler.wrap);
+    __m128i c = _mm_loadu_si32(level.texel_ptr(x, y));
+    return unpack_color(_mm_unpacklo_epi8(c, zero));
+  }
+
+  // texel centers are at +0.5, so the footprint starts half a texel back
+  i32 fu = (i32)std::floor((u * level.width - 0.5f) * weight_scale);
+  i32 fv = (i32)std::floor((v * level.height - 0.5f) * weight_scale);
+  i32 x0 = fu >> weight_bits;
+  i32 y0 = fv >> weight_bits;
+  i16 wx = (i16)(fu & ((1 << weight_bits) - 1));
+  i16 wy = (i16)(fv & ((1 << weight_bits) - 1));
+
+  u32 xa = wrap_coord(x0, level.width, sampler.wrap);
+  u32 xb = wrap_coord(x0 + 1, level.width, sampler.wrap);
+  u32 ya = wrap_coord(y0, level.height, sampler.wrap);
+  u32 yb = wrap_coord(y0 + 1, level.height, sampler.wrap);
+
+  // rows of the footprint as [left | right], 16 bits per channel
+  __m128i top = _mm_unpacklo_epi8(
+      _mm_unpacklo_epi32(
+          _mm_loadu_si32(level.texel_ptr(xa, ya)),
+          _mm_loadu_si32(level.texel_ptr(xb, ya))),
+      zero);
+  __m128i bottom = _mm_unpacklo_epi8(
+      _mm_unpacklo_epi32(
+          _mm_loadu_si32(level.texel_ptr(xa, yb)),
+          _mm_loadu_si32(level.texel_ptr(xb, yb))),
+      zero);
+
+  // vertical lerp for both columns at once, then the horizontal one
+  __m128i col = _mm_add_epi16(
+      top, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(bottom, top),
+                                          _mm_set1_epi16(wy)),
+                          weight_bits));
+  __m128i right = _mm_srli_si128(col, 8);
+  __m128i c = _mm_add_epi16(
+      col, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(right, col),
+                                          _mm_set1_epi16(wx)),
+                          weight_bits));
+  return unpack_color(c);
+}
+} // namespace texture_detail
+
+// A texture together with the sampler it is read with, see
+// rendering_pipeline::bind_texture.
+struct texture_binding {
+  const texture *tex = nullptr;
+  sampler_state sampler;
+
+  /// <summary>
+  /// Samples the texture at (u, v) from the mip level lod, fractional lods
+  /// are blended with mip_filter::linear.
+  /// </summary>
+  math::vec4 sample(f32 u, f32 v, f32 lod = 0.f) const {
+    assert(tex);
+    __m128 c = sample_lod(u, v, lod);
+
+    math::vec4 out;
+    _mm_storeu_ps(out.values, c);
+    return out;
+  }
+
+  /// <summary>
+  /// Samples the texture for every lane of a quad. The texture coordinates
+  /// are varying floats u and v of the quad, the lod comes from their
+  /// screen space derivatives, so minified textures read from smaller mips.
+  /// </summary>
+  void sample_quad(const fragment_quad &quad, u32 u, u32 v,
+                   math::vec4 out[quad_lanes]) const {
+    assert(tex);
+    f32 lod = 0.f;
+    if (sampler.mip != mip_filter::none) {
+      f32 w = (f32)tex->get_width();
+      f32 h = (f32)tex->get_height();
+      f32 dudx = quad.ddx(u) * w, dvdx = quad.ddx(v) * h;
+      f32 dudy = quad.ddy(u) * w, dvdy = quad.ddy(v) * h;
+      f32 rho2 = std::max(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy);
+
+      // log2 of the longer footprint axis, in texels
+      lod = rho2 > 0.f ? 0.5f * std::log2(rho2) : 0.f;
+    }
+
+    // helper lanes only exist for the derivatives
+    for (u32 m = quad.mask; m; m &= m - 1) {
+      u32 lane = (u32)std::countr_zero(m);
+      _mm_storeu_ps(out[lane].values,
+                    sample_lod(quad.get(u, lane), quad.get(v, lane), lod));
+    }
+  }
+
+private:
+  __m128 sample_lod(f32 u, f32 v, f32 lod) const {
+    f32 max_level = (f32)(tex->get_levels() - 1);
+    lod = std::clamp(lod, 0.f, max_level);
+
+    switch (sampler.mip) {
+    case mip_filter::nearest:
+      return texture_detail::sample_level(
+          tex->get_level((u32)(lod + 0.5f)), sampler, u, v);
+    case mip_filter::linear: {
+      u32 level = (u32)lod;
+      f32 t = lod - (f32)level;
+      __m128 a =
+          texture_detail::sample_level(tex->get_level(level), sampler, u, v);
+      if (t == 0.f)
+        return a;
+
+      __m128 b = texture_detail::sample_level(tex->get_level(level + 1),
+                                              sampler, u, v);
+      return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(t)));
+    }
+    case mip_filter::none:
+    default:
+      return texture_detail::sample_level(tex->get_level(0), sampler, u, v);
+    }
+  }
+};
+
+// Texture slots of a draw.
+static constexpr u32 max_texture_slots = 8;
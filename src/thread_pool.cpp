@@ -0,0 +1,82 @@
+#include "thread_pool.hpp"
+
+thread_pool::thread_pool(u32 num_threads) {
+  if (num_threads == 0)
+    num_threads = 1;
+
+  for (u32 i = 1; i < num_threads; ++i)
+    workers.emplace_back(&thread_pool::worker_main, this, i);
+}
+
+thread_pool::~thread_pool() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  wake_cv.notify_all();
+
+  for (std::thread &t : workers)
+    t.join();
+}
+
+void thread_pool::parallel_for(u32 count,
+                               const std::function<void(u32, u32)> &fn) {
+  if (count == 0)
+    return;
+
+  if (workers.empty() || count == 1) {
+    for (u32 i = 0; i < count; ++i)
+      fn(i, 0);
+    return;
+  }
+
+  {
+    std::lock_guard lock(mutex);
+    job = &fn;
+    job_count = count;
+    next_index.store(0, std::memory_order_relaxed);
+    active_workers = (u32)workers.size();
+    ++generation;
+  }
+  wake_cv.notify_all();
+
+  run_jobs(0);
+
+  std::unique_lock lock(mutex);
+  done_cv.wait(lock, [&] { return active_workers == 0; });
+  job = nullptr;
+}
+
+void thread_pool::worker_main(u32 worker) {
+  u64 seen_generation = 0;
+
+  for (;;) {
+    {
+      std::unique_lock lock(mutex);
+      wake_cv.wait(lock, [&] {
+        return stopping || generation != seen_generation;
+      });
+
+      if (stopping)
+        return;
+
+      seen_generation = generation;
+    }
+
+    run_jobs(worker);
+
+    std::lock_guard lock(mutex);
+    if (--active_workers == 0)
+      done_cv.notify_one();
+  }
+}
+
+void thread_pool::run_jobs(u32 worker) {
+  for (;;) {
+    u32 i = next_index.fetch_add(1, std::memory_order_relaxed);
+    if (i >= job_count)
+      break;
+
+    (*job)(i, worker);
+  }
+}
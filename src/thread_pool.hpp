@@ -0,0 +1,45 @@
+#pragma once
+
+#include "types.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct thread_pool {
+  // num_threads includes the calling thread, so 1 runs everything inline
+  explicit thread_pool(u32 num_threads = std::thread::hardware_concurrency());
+  ~thread_pool();
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  /// <summary>
+  /// Calls fn(index, worker) for every index in [0, count) and blocks until
+  /// all of them are done. Indices are handed out dynamically, worker is a
+  /// stable id in [0, get_num_threads()) that can be used for per-thread data.
+  /// The calling thread participates as worker 0.
+  /// </summary>
+  void parallel_for(u32 count, const std::function<void(u32, u32)> &fn);
+
+  inline u32 get_num_threads() const { return (u32)workers.size() + 1; }
+
+private:
+  void worker_main(u32 worker);
+  void run_jobs(u32 worker);
+
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable wake_cv;
+  std::condition_variable done_cv;
+
+  const std::function<void(u32, u32)> *job = nullptr;
+  u32 job_count = 0;
+  std::atomic<u32> next_index = 0;
+  u32 active_workers = 0;
+  u64 generation = 0;
+  b8 stopping = false;
+};
@@ -5,19 +5,69 @@
 #include "vector.hpp"
 #include <array>
 #include <cassert>
+#include <immintrin.h>
+
+// Attribute that is linear in screen space, evaluated at pixel centers as
+// a * x + b * y + c, x and y relative to the origin of the plane.
+struct plane_eq {
+  f32 a, b, c;
+
+  inline f32 eval(f32 x, f32 y) const { return a * x + b * y + c; }
+};
+
+// Varyings are interpolated from per triangle planes of value / w, which
+// (unlike the value itself) is linear in screen space. The planes of a
+// triangle are three arrays, all a, then all b, then all c, each padded to
+// plane_floats so four varying floats are evaluated per instruction.
+static constexpr u32 plane_floats(u32 floats) { return (floats + 3) & ~3u; }
+
+// floats is the number of floats in a varying. w is the plane of 1 / w, x
+// and y are relative to the plane origin. dst needs room for
+// plane_floats(floats) floats.
+inline void interpolate_planes(const f32 *planes, u32 floats,
+                               const plane_eq &w, f32 x, f32 y, f32 *dst) {
+  u32 stride = plane_floats(floats);
+  const f32 *pa = planes;
+  const f32 *pb = planes + stride;
+  const f32 *pc = planes + 2 * stride;
+
+  __m128 vx = _mm_set1_ps(x);
+  __m128 vy = _mm_set1_ps(y);
+  __m128 inv_w = _mm_set1_ps(1.f / w.eval(x, y));
+
+  for (u32 i = 0; i < stride; i += 4) {
+    __m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(pa + i), vx),
+                          _mm_mul_ps(_mm_loadu_ps(pb + i), vy));
+    v = _mm_add_ps(v, _mm_loadu_ps(pc + i));
+    _mm_storeu_ps(dst + i, _mm_mul_ps(v, inv_w));
+  }
+}
 
-inline void interpolate_vars(const void *src, void *dst, size_t size,
-                             math::vec3 w) {
-  size_t count = size / sizeof(f32);
-
-  const f32 *v0 = (const f32 *)src;
-  const f32 *v1 = (const f32 *)((const u8 *)src + size);
-  const f32 *v2 = (const f32 *)((const u8 *)src + 2 * size);
-
-  f32 *out = (f32 *)dst;
-
-  for (size_t i = 0; i < count; ++i) {
-    out[i] = v0[i] * w.x + v1[i] * w.y + v2[i] * w.z;
+// Interpolates the varyings for the 2x2 quad whose top left pixel is (x, y)
+// relative to the plane origin. dst receives them in structure of arrays form
+// (see fragment_quad) and must be 16 byte aligned.
+inline void interpolate_planes_quad(const f32 *planes, u32 floats,
+                                    const plane_eq &w, f32 x, f32 y,
+                                    f32 *dst) {
+  u32 stride = plane_floats(floats);
+  const f32 *pa = planes;
+  const f32 *pb = planes + stride;
+  const f32 *pc = planes + 2 * stride;
+
+  // pixel offsets of the lanes
+  const __m128 dx = _mm_setr_ps(0.f, 1.f, 0.f, 1.f);
+  const __m128 dy = _mm_setr_ps(0.f, 0.f, 1.f, 1.f);
+
+  __m128 vw = _mm_add_ps(_mm_set1_ps(w.eval(x, y)),
+                         _mm_add_ps(_mm_mul_ps(_mm_set1_ps(w.a), dx),
+                                    _mm_mul_ps(_mm_set1_ps(w.b), dy)));
+  __m128 inv_w = _mm_div_ps(_mm_set1_ps(1.f), vw);
+
+  for (u32 i = 0; i < floats; ++i) {
+    __m128 v = _mm_add_ps(_mm_set1_ps(pa[i] * x + pb[i] * y + pc[i]),
+                          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(pa[i]), dx),
+                                     _mm_mul_ps(_mm_set1_ps(pb[i]), dy)));
+    _mm_store_ps(dst + i * 4, _mm_mul_ps(v, inv_w));
   }
 }
 
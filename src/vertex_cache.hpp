@@ -0,0 +1,73 @@
+#pragma once
+
+#include "types.hpp"
+#include <algorithm>
+#include <bit>
+#include <vector>
+
+// Post transform vertex cache keyed by index. Every index maps to the slot its
+// shaded output was stored in, so each unique vertex of a draw is shaded
+// exactly once. The indices are hashed into an open addressing table sized
+// from the index count of the draw, never from the values of the indices, so
+// a mesh with a few large indices costs no more memory than a compact one.
+// Entries are tagged with a draw generation, which makes starting a new draw
+// O(1) instead of clearing the table.
+struct vertex_cache {
+  /// <summary>
+  /// Starts a draw of at most index_count indices, growing the table so it
+  /// stays at most half full.
+  /// </summary>
+  void begin_draw(size index_count) {
+    used = 0;
+
+    size capacity = std::bit_ceil(std::max<size>(index_count * 2, 64));
+    if (capacity > entries.size()) {
+      entries.assign(capacity, entry{});
+      shift = 32 - (u32)std::countr_zero(capacity);
+      generation = 0;
+    }
+
+    if (++generation == 0) {
+      std::fill(entries.begin(), entries.end(), entry{});
+      generation = 1;
+    }
+  }
+
+  /// <summary>
+  /// Finds the slot of index, or assigns it the next free one.
+  /// </summary>
+  /// <returns>true if index was already shaded during this draw</returns>
+  b8 lookup(u32 index, u32 &slot) {
+    size mask = entries.size() - 1;
+    // Fibonacci hashing, the top bits of the product are the best mixed
+    size i = (size)((index * 2654435769u) >> shift);
+
+    for (;; i = (i + 1) & mask) {
+      entry &e = entries[i];
+      if (e.stamp != generation) {
+        e = entry{generation, index, used++};
+        slot = e.slot;
+        return false;
+      }
+      if (e.index == index) {
+        slot = e.slot;
+        return true;
+      }
+    }
+  }
+
+  // number of unique vertices seen during the current draw
+  inline u32 get_num_slots() const { return used; }
+
+private:
+  struct entry {
+    u32 stamp;
+    u32 index;
+    u32 slot;
+  };
+
+  std::vector<entry> entries;
+  u32 shift = 32;
+  u32 generation = 0;
+  u32 used = 0;
+};
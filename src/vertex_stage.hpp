@@ -0,0 +1,98 @@
+#pragma once
+
+#include "buffer.hpp"
+#include "shader_program.hpp"
+#include "thread_pool.hpp"
+#include "types.hpp"
+#include "vector.hpp"
+#include <algorithm>
+#include <vector>
+
+// Vertices are shaded in chunks of this many, one chunk per job.
+static constexpr u32 vertex_chunk_size = 256;
+
+// Transient output of the vertex stage for one draw, in structure of arrays
+// form: every clip position component and every varying float is a stream of
+// get_count() floats. Storage is kept between draws and only grows.
+struct vertex_arena {
+  void reset(u32 count, u32 varying_floats) {
+    this->count = count;
+    this->varying_floats = varying_floats;
+
+    // keep every stream 32 byte aligned relative to the first one
+    stride = (count + 7) & ~7u;
+    storage.resize((size)stride * (4 + varying_floats));
+  }
+
+  // component 0..3 is x, y, z, w
+  inline f32 *position_stream(u32 component) {
+    return storage.data() + (size)component * stride;
+  }
+  inline f32 *varying_stream(u32 i) {
+    return storage.data() + (size)(4 + i) * stride;
+  }
+
+  inline math::vec4 get_position(u32 v) const {
+    const f32 *p = storage.data() + v;
+    return math::vec4{p[0], p[stride], p[2 * stride], p[3 * stride]};
+  }
+
+  // gathers the varyings of vertex v back into the packed layout
+  inline void get_varyings(u32 v, f32 *out) const {
+    const f32 *p = storage.data() + (size)4 * stride + v;
+    for (u32 i = 0; i < varying_floats; ++i)
+      out[i] = p[(size)i * stride];
+  }
+
+  inline u32 get_count() const { return count; }
+
+private:
+  std::vector<f32> storage;
+  u32 count = 0;
+  u32 varying_floats = 0;
+  u32 stride = 0;
+};
+
+/// <summary>
+/// Runs the vertex shader over a range of vertices in parallel chunks and
+/// writes clip positions and varyings into the arena.
+/// </summary>
+/// <param name="vertex_ids">Vertex buffer element for every arena slot, or
+/// nullptr to shade elements [0, count)</param>
+/// <param name="x_scale">Applied to clip space x of every vertex</param>
+template <typename Shader>
+static void shade_vertices(thread_pool &pool, const Shader &shader,
+                           vertex_buffer vbuf, const u32 *vertex_ids,
+                           u32 count, f32 x_scale, vertex_arena &arena) {
+  u32 varying_floats = (u32)(shader.varying_size() / sizeof(f32));
+  arena.reset(count, varying_floats);
+
+  f32 *px = arena.position_stream(0);
+  f32 *py = arena.position_stream(1);
+  f32 *pz = arena.position_stream(2);
+  f32 *pw = arena.position_stream(3);
+
+  u32 n_chunks = (count + vertex_chunk_size - 1) / vertex_chunk_size;
+
+  pool.parallel_for(n_chunks, [&](u32 chunk, u32) {
+    u32 begin = chunk * vertex_chunk_size;
+    u32 end = std::min(begin + vertex_chunk_size, count);
+
+    f32 vars[max_varying_size / sizeof(f32)];
+
+    for (u32 v = begin; v < end; ++v) {
+      size id = vertex_ids ? vertex_ids[v] : v;
+      math::vec4 pos;
+
+      shader.vertex_shader(vbuf.data + id * vbuf.stride, &pos, vars);
+
+      px[v] = pos.x * x_scale;
+      py[v] = pos.y;
+      pz[v] = pos.z;
+      pw[v] = pos.w;
+
+      for (u32 i = 0; i < varying_floats; ++i)
+        arena.varying_stream(i)[v] = vars[i];
+    }
+  });
+}
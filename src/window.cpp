@@ -2,6 +2,7 @@
 
 #include "event.hpp"
 #include "framebuffer.hpp"
+#include "profiler.hpp"
 
 b8 window::init(std::string_view title, i32 width, i32 height) {
   i32 success = SDL_Init(SDL_INIT_VIDEO);
@@ -36,6 +37,9 @@ b8 window::init(std::string_view title, i32 width, i32 height) {
     return false;
   }
 
+  texture_width = width;
+  texture_height = height;
+
   return true;
 }
 
@@ -99,8 +103,48 @@ void window::process_events() {
 }
 
 void window::display_framebuffer(const framebuffer &fb) {
-  SDL_UpdateTexture(texture, NULL, fb.color_buffer.get(),
-                    fb.width * sizeof(color));
+  PROFILE_ZONE("display_framebuffer");
+
+  // uploads straight from the framebuffer unless it has to be detiled or
+  // resolved, or still has tiles waiting for their clear
+  const color *pixels = fb.color_buffer;
+  if (fb.get_layout() != framebuffer_layout::linear || fb.get_samples() > 1 ||
+      !fb.color_resolved()) {
+    staging.resize((size)fb.width * fb.height);
+    fb.read_color(staging.data());
+    pixels = staging.data();
+  }
+
+  SDL_UpdateTexture(texture, NULL, pixels, fb.width * sizeof(color));
+  SDL_RenderClear(renderer);
+  SDL_RenderTexture(renderer, texture, NULL, NULL);
+  SDL_RenderPresent(renderer);
+}
+
+b8 window::begin_frame(framebuffer &fb) {
+  assert(fb.get_layout() == framebuffer_layout::linear);
+  assert((i32)fb.get_width() == texture_width);
+  assert((i32)fb.get_height() == texture_height);
+
+  void *pixels = nullptr;
+  i32 pitch = 0;
+  if (!SDL_LockTexture(texture, NULL, &pixels, &pitch)) {
+    // Log failure
+    return false;
+  }
+
+  fb.borrow_color_storage((color *)pixels, (size)pitch);
+  return true;
+}
+
+void window::present_frame(framebuffer &fb) {
+  PROFILE_ZONE("present_frame");
+
+  // tiles no draw touched still hold whatever the texture had
+  fb.resolve(true, false);
+  fb.return_color_storage();
+  SDL_UnlockTexture(texture);
+
   SDL_RenderClear(renderer);
   SDL_RenderTexture(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
@@ -1,6 +1,8 @@
+#include "color.hpp"
 #include "types.hpp"
 #include <SDL3/SDL.h>
 #include <string_view>
+#include <vector>
 
 struct window {
   // Window(std::string_view title, i32 width, i32 height);
@@ -9,8 +11,19 @@ struct window {
   void process_events();
   void display_framebuffer(const struct framebuffer &fb);
 
+  // Zero copy presentation: begin_frame locks the streaming texture and lends
+  // its memory to fb, so the frame is drawn straight into it. present_frame
+  // takes the memory back and presents it. fb has to be linear and the size
+  // of the window.
+  b8 begin_frame(struct framebuffer &fb);
+  void present_frame(struct framebuffer &fb);
+
 private:
   SDL_Window *window_handle = nullptr;
   SDL_Renderer *renderer = nullptr;
   SDL_Texture *texture = nullptr;
+  i32 texture_width = 0, texture_height = 0;
+
+  // detiled copy of framebuffers that are not stored linearly
+  std::vector<color> staging;
 };
\ No newline at end of file